@@ -1,10 +1,13 @@
 #include "disk.h"
 #include "io.h"
 #include "screen.h"
-#include "../memory/kmalloc.h"
 #include "../memory/utills.h"
 #include "../memory/vmm.h"
+#include "../memory/pmm.h"
+#include "../memory/arena.h"
+#include "../memory/buddy.h"
 #include "../std/stdio.h"
+#include "../std/assert.h"
 /*
  * Explanation about the delay that appears sometimes in the code:
  * According to the ATA specifications, after selecting a new drive (Master/Slave),
@@ -32,89 +35,6 @@ static identifyDeviceData disk4 = {0};
 
 static identifyDeviceData *disks[4] = {&disk1, &disk2, &disk3, &disk4};
 
-#define DISK_BITMAP_SIZE 100000 // TODO: Change this to be dynamic with kmalloc and the size in the disks
-static uint8_t disk_bitmap[DISK_BITMAP_SIZE] = {0};
-
-inline static bool is_slot_free(const uint32_t slot) {
-    return !(disk_bitmap[slot / 8] & (1 << (slot % 8)));
-}
-
-inline static void disk_mark_used(const uint32_t slot) {
-    disk_bitmap[slot / 8] |= (1 << (slot % 8));
-}
-
-static inline bool are_slots_free(const uint32_t start, const uint32_t count) {
-    const uint32_t limit = DISK_BITMAP_SIZE * 8;
-    if (start + count > limit)
-        return false;
-    for (uint32_t k = 0; k < count; k++) {
-        if (!is_slot_free(start + k)) return false;
-    }
-    return true;
-}
-
-
-static inline void mark_slots_used(const uint32_t start, const uint32_t count) {
-    for (uint32_t k = 0; k < count; k++) disk_mark_used(start + k);
-}
-
-inline static void disk_mark_free(const uint32_t slot) {
-    disk_bitmap[slot / 8] = disk_bitmap[slot / 8] & ~(1 << (slot % 8));
-}
-
-
-/*
- * Free a previously allocated disk slot.
- */
-void disk_free_slot(const uint32_t slot) {
-    disk_mark_free(slot);
-}
-
-void disk_free_slots(const uint32_t slot, const uint8_t slots_num) {
-    if (slot + slots_num >= DISK_BITMAP_SIZE * 8) return;
-    for (uint8_t i = 0; i < slots_num; i++)
-        disk_mark_free(slot + i);
-}
-
-// allocate via next fit algorithm
-
-
-static size_t last_alloc_index = 1;
-
-
-uint32_t disk_alloc_slots(const uint8_t slots_num) {
-    if (slots_num == 0) return DISK_NO_SLOT_AVAILABLE;
-
-    // Next-fit: from last_alloc_index to end (byte-wise), then wrap
-    for (size_t i = last_alloc_index; i < DISK_BITMAP_SIZE; i++) {
-        for (uint8_t j = 0; j < 8; j++) {
-            const uint32_t slot = (uint32_t) i * 8 + j;
-            if (!is_slot_free(slot)) continue;
-
-            if (are_slots_free(slot, slots_num)) {
-                mark_slots_used(slot, slots_num);
-                last_alloc_index = (slot + slots_num) / 8;
-                return slot;
-            }
-        }
-    }
-    for (size_t i = 0; i < last_alloc_index; i++) {
-        for (uint8_t j = 0; j < 8; j++) {
-            const uint32_t slot = (uint32_t) i * 8 + j;
-            if (!is_slot_free(slot)) continue;
-
-            if (are_slots_free(slot, slots_num)) {
-                mark_slots_used(slot, slots_num);
-                last_alloc_index = (slot + slots_num) / 8;
-                return slot;
-            }
-        }
-    }
-    return DISK_NO_SLOT_AVAILABLE;
-}
-
-
-
 /*
  * The following functions are used to extract the LBA address into its components.
  * The lba address is 24 bits long and is divided into 4 parts:
@@ -499,9 +419,12 @@ bool ata_write_sectors(uint8_t disk_num, const uint32_t lba_address, const uint8
 
         buffer16 += disk->logical_sector_size / 2;
         asm volatile("jmp 1f\n\t" "1:");  // small delay to allow the drive to finish the operation
-        flush_cache(disk_num);
     }
 
+    // A single flush for the whole command, a flush after every sector would cost a cache write each
+    if (!ata_wait_for_bsy(base_port))
+        return false;
+    flush_cache(disk_num);
     return true;
 
 
@@ -563,7 +486,8 @@ size_t disk_read(uint32_t addr, void *buffer, const size_t len) {
     /* Calculate the number of sectors needed to cover len bytes (rounding up) */
     size_t total_sectors = (len + sector_size - 1) / sector_size;
 
-    /* Temporary buffer to hold one sector's data */
+    /* The transfer buffers come from the scratch arena - DMA zone memory that stays mapped between calls */
+    arena_t *const scratch = arena_scratch();
     while (total_sectors > 0) {
         uint8_t sectors_this_call;
         size_t bytes_ths_call;
@@ -575,13 +499,14 @@ size_t disk_read(uint32_t addr, void *buffer, const size_t len) {
             bytes_ths_call = sectors_this_call * sector_size;
         }
 
-        void *temp_buffer = kmalloc(bytes_ths_call);
+        const arena_scope_t scope = arena_begin(scratch);
+        void *temp_buffer = arena_alloc(scratch, bytes_ths_call);
         if (!temp_buffer)
             return total_read;
         memset(temp_buffer, 0, bytes_ths_call);
         /* Read sectors from the disk */
         if (!ata_read_sectors(curr_disk, (uint32_t) addr, sectors_this_call, temp_buffer)) {
-            kfree(temp_buffer);
+            arena_end(scratch, scope);
             return total_read;
         }
 
@@ -596,7 +521,7 @@ size_t disk_read(uint32_t addr, void *buffer, const size_t len) {
             bytes_this_call = len - total_read;
 
         memcpy((uint8_t *) buffer + total_read, temp_buffer, bytes_this_call);
-        kfree(temp_buffer);
+        arena_end(scratch, scope);
         total_read += bytes_this_call;
         total_sectors -= sectors_read;
         addr += sectors_read;
@@ -626,7 +551,8 @@ size_t disk_write(uint32_t lba, const void *buffer, const size_t len) {
     const size_t sector_size = disk->logical_sector_size;
     size_t total_sectors = len / sector_size;
 
-    /* Temporary buffer to hold one sector's data */
+    /* The transfer buffers come from the scratch arena - DMA zone memory that stays mapped between calls */
+    arena_t *const scratch = arena_scratch();
     while (total_sectors > 0) {
         const uint8_t sectors_this_call = (total_sectors >= MAX_SECTORS_PER_CALL_SIZE)
                                               ? ATA_PIO_MAX_SECTORS_PER_CMD // ATA: 0→256
@@ -636,17 +562,18 @@ size_t disk_write(uint32_t lba, const void *buffer, const size_t len) {
                                         ? MAX_SECTORS_PER_CALL_SIZE
                                         : sectors_this_call;
         const size_t bytes_this_call = sectors_xfer * sector_size;
-        void *const temp_buffer = (uint8_t *) kmalloc(bytes_this_call);
+        const arena_scope_t scope = arena_begin(scratch);
+        void *const temp_buffer = arena_alloc(scratch, bytes_this_call);
         if (!temp_buffer)
             return total_written;
         memset(temp_buffer, 0, bytes_this_call);
         memcpy(temp_buffer, (const uint8_t *) buffer + total_written, bytes_this_call);
 
         if (!ata_write_sectors(curr_disk, lba, sectors_this_call, temp_buffer)) {
-            kfree(temp_buffer);
+            arena_end(scratch, scope);
             return total_written;
         }
-        kfree(temp_buffer);
+        arena_end(scratch, scope);
         total_written += bytes_this_call;
         total_sectors -= sectors_xfer;
         lba += sectors_xfer;
@@ -657,21 +584,205 @@ size_t disk_write(uint32_t lba, const void *buffer, const size_t len) {
         // The last sector is not full, so we need to read it and write it back to make sure
         // we don't overwrite data
         const uint32_t last_sector = lba;
-        void *const temp = kmalloc(disk->logical_sector_size);
+        const arena_scope_t scope = arena_begin(scratch);
+        void *const temp = arena_alloc(scratch, disk->logical_sector_size);
         if (!temp)
             return total_written;
-        if (!ata_read_sectors(curr_disk, last_sector, 1, temp))
+        if (!ata_read_sectors(curr_disk, last_sector, 1, temp)) {
+            arena_end(scratch, scope);
             return total_written;
+        }
         memcpy(temp, (uint8_t *) buffer + total_written, len % disk->logical_sector_size);
-        if (!ata_write_sectors(curr_disk, last_sector, 1, temp))
+        const bool written = ata_write_sectors(curr_disk, last_sector, 1, temp);
+        arena_end(scratch, scope);
+        if (!written)
             return total_written;
-        kfree(temp);
-        flush_cache(curr_disk);
     }
     return len;
 }
 
+size_t disk_write_direct(uint32_t lba, const void *buffer, const size_t len) {
+    identifyDeviceData *disk = disks[curr_disk];
+    if (!disk || !disk->valid || len % disk->logical_sector_size)
+        return 0;
+
+    const size_t sector_size = disk->logical_sector_size;
+    size_t total_written = 0;
+    while (total_written < len) {
+        const size_t sectors_left = (len - total_written) / sector_size;
+        const size_t sectors_xfer = sectors_left >= MAX_SECTORS_PER_CALL_SIZE ? MAX_SECTORS_PER_CALL_SIZE : sectors_left;
+        const uint8_t sectors_this_call = sectors_xfer == MAX_SECTORS_PER_CALL_SIZE
+                                              ? ATA_PIO_MAX_SECTORS_PER_CMD // ATA: 0→256
+                                              : (uint8_t) sectors_xfer;
+        if (!ata_write_sectors(curr_disk, lba, sectors_this_call, (uint8_t *) buffer + total_written))
+            return total_written;
+        total_written += sectors_xfer * sector_size;
+        lba += sectors_xfer;
+    }
+    return total_written;
+}
+
 size_t disk_get_current_disk_logical_sector_size() {
     return disks[curr_disk]->logical_sector_size;
 }
 
+// ------------------------------------------------------------
+// Swap area - the sectors of the current disk that hold swapped out pages.
+// It is managed in page sized clusters by a buddy allocator, so a run of clusters is found with a few bit scans
+// instead of a scan of every slot. A cluster can be shared (a fork keeps a swapped out page swapped out in both
+// vm contexts), so every cluster has a reference count and is freed when the last reference is dropped.
+// The metadata is sized from the area and lives in the identity mapped DMA zone - it can never be swapped out
+// itself.
+
+typedef struct {
+    uint32_t first_sector;        // The first sector of the area, cluster 0
+    uint32_t sectors_per_cluster; // Sectors in a page sized cluster
+    buddy_t clusters;             // A unit is a cluster, its units are 0 when there is no swap area
+    uint16_t *refcounts;          // References of every cluster, 0 if the cluster is free
+    uint32_t *metadata;           // The frames of the buddy metadata and the reference counts
+    uint8_t metadata_order;
+} swap_area_t;
+
+static swap_area_t swap_area = {0};
+
+static inline uint32_t slots_to_clusters(const uint32_t slots_num) {
+    return (slots_num + swap_area.sectors_per_cluster - 1) / swap_area.sectors_per_cluster;
+}
+
+/*
+ * Returns the cluster of the slot, or BUDDY_NO_BLOCK if the slot is not the start of a cluster in the swap area
+ */
+static size_t slot_to_cluster(const uint32_t slot) {
+    if (swap_area.clusters.units == 0 || slot < swap_area.first_sector)
+        return BUDDY_NO_BLOCK;
+    const uint32_t offset = slot - swap_area.first_sector;
+    if (offset % swap_area.sectors_per_cluster != 0 || offset / swap_area.sectors_per_cluster >= swap_area.clusters.units)
+        return BUDDY_NO_BLOCK;
+    return offset / swap_area.sectors_per_cluster;
+}
+
+/*
+ * Looks for a Linux swap partition in the MBR of the current disk.
+ * return true and fills the partition if there is one
+ */
+static bool find_swap_partition(uint32_t *first_sector, uint32_t *sector_count) {
+    arena_t *const scratch = arena_scratch();
+    const arena_scope_t scope = arena_begin(scratch);
+    const uint8_t *mbr = arena_alloc(scratch, disk_get_current_disk_logical_sector_size());
+    bool found = false;
+    if (mbr != NULL && ata_read_sectors(curr_disk, 0, 1, (void *) mbr) &&
+        mbr[MBR_SIGNATURE_OFFSET] == 0x55 && mbr[MBR_SIGNATURE_OFFSET + 1] == 0xAA) {
+        for (int i = 0; i < MBR_PARTITIONS_COUNT && !found; i++) {
+            const mbr_partition_t *partition = (const mbr_partition_t *)
+                (mbr + MBR_PARTITIONS_OFFSET + i * sizeof(mbr_partition_t));
+            if (partition->type == MBR_PARTITION_TYPE_SWAP && partition->sector_count > 0) {
+                *first_sector = partition->first_lba;
+                *sector_count = partition->sector_count;
+                found = true;
+            }
+        }
+    }
+    arena_end(scratch, scope);
+    return found;
+}
+
+bool disk_set_swap_area(uint32_t first_sector, uint32_t sector_count) {
+    const identifyDeviceData *disk = disks[curr_disk];
+    if (!disk->valid || disk->logical_sector_size == 0 || disk->logical_sector_size > PAGE_SIZE ||
+        first_sector >= disk->total_sectors || first_sector >= DISK_SWAP_SLOTS_LIMIT)
+        return false;
+    // The area ends at the disk, and at the slots a page entry can hold
+    if (sector_count > disk->total_sectors - first_sector)
+        sector_count = disk->total_sectors - first_sector;
+    if (sector_count > DISK_SWAP_SLOTS_LIMIT - first_sector)
+        sector_count = DISK_SWAP_SLOTS_LIMIT - first_sector;
+    const uint32_t sectors_per_cluster = PAGE_SIZE / disk->logical_sector_size;
+    const size_t clusters = sector_count / sectors_per_cluster;
+    if (clusters == 0)
+        return false;
+
+    const size_t buddy_bytes = BUDDY_METADATA_WORDS(clusters) * sizeof(uint32_t);
+    const size_t metadata_frames = (buddy_bytes + clusters * sizeof(uint16_t) + PMM_BLOCK_SIZE - 1) / PMM_BLOCK_SIZE;
+    const uint8_t metadata_order = buddy_order_of(metadata_frames);
+    const physical_addr metadata = pmm_alloc_frames_zone(ZONE_DMA, metadata_order);
+    if (metadata == PMM_NO_FRAME_AVAILABLE)
+        return false;
+
+    // The previous area is dropped, with the pages that were swapped to it
+    if (swap_area.metadata != NULL)
+        pmm_free_frames((physical_addr) swap_area.metadata, swap_area.metadata_order);
+    swap_area.metadata = (uint32_t *) metadata;
+    swap_area.metadata_order = metadata_order;
+    swap_area.first_sector = first_sector;
+    swap_area.sectors_per_cluster = sectors_per_cluster;
+    buddy_init(&swap_area.clusters, clusters, swap_area.metadata);
+    buddy_free_range(&swap_area.clusters, 0, clusters);
+    swap_area.refcounts = (uint16_t *) (metadata + buddy_bytes);
+    memset(swap_area.refcounts, 0, clusters * sizeof(uint16_t));
+    return true;
+}
+
+bool disk_init_swap_area() {
+    if (!disks[curr_disk]->valid)
+        return false;
+    uint32_t first_sector, sector_count;
+    if (find_swap_partition(&first_sector, &sector_count))
+        return disk_set_swap_area(first_sector, sector_count);
+    // No swap partition, so the whole disk after its first page (the MBR and the boot loader) is swap
+    return disk_set_swap_area(PAGE_SIZE / disk_get_current_disk_logical_sector_size(), disks[curr_disk]->total_sectors);
+}
+
+uint32_t disk_alloc_slots(const uint32_t slots_num) {
+    if (slots_num == 0 || swap_area.clusters.units == 0)
+        return DISK_NO_SLOT_AVAILABLE;
+
+    // The buddy hands out power of two runs, the clusters after the run that was asked for are given back
+    const uint32_t clusters = slots_to_clusters(slots_num);
+    const uint8_t order = buddy_order_of(clusters);
+    const size_t first = buddy_alloc(&swap_area.clusters, order);
+    if (first == BUDDY_NO_BLOCK)
+        return DISK_NO_SLOT_AVAILABLE;
+    buddy_free_range(&swap_area.clusters, first + clusters, ((size_t) 1 << order) - clusters);
+    for (size_t i = first; i < first + clusters; i++)
+        swap_area.refcounts[i] = 1;
+    return swap_area.first_sector + first * swap_area.sectors_per_cluster;
+}
+
+void disk_get_slots(const uint32_t slot, const uint32_t slots_num) {
+    const size_t first = slot_to_cluster(slot);
+    if (first == BUDDY_NO_BLOCK)
+        return;
+    const size_t end = first + slots_to_clusters(slots_num);
+    for (size_t i = first; i < end && i < swap_area.clusters.units; i++) {
+        assert(swap_area.refcounts[i] > 0 && swap_area.refcounts[i] < 0xFFFF); // a reference to a free slot
+        swap_area.refcounts[i]++;
+    }
+}
+
+void disk_free_slots(const uint32_t slot, const uint32_t slots_num) {
+    const size_t first = slot_to_cluster(slot);
+    if (first == BUDDY_NO_BLOCK || slots_num == 0)
+        return;
+    size_t end = first + slots_to_clusters(slots_num);
+    if (end > swap_area.clusters.units)
+        end = swap_area.clusters.units;
+
+    // The clusters whose last reference is dropped are given back in runs
+    size_t run = first;
+    for (size_t i = first; i < end; i++) {
+        assert(swap_area.refcounts[i] > 0); // double free
+        if (--swap_area.refcounts[i] > 0) {
+            buddy_free_range(&swap_area.clusters, run, i - run);
+            run = i + 1;
+        }
+    }
+    buddy_free_range(&swap_area.clusters, run, end - run);
+}
+
+void disk_free_slot(const uint32_t slot) {
+    disk_free_slots(slot, 1);
+}
+
+size_t disk_get_swap_free_slots() {
+    return swap_area.clusters.free_units * swap_area.sectors_per_cluster;
+}
@@ -11,6 +11,8 @@
 #include "../std/stdbool.h"
 
 #define DISK_NO_SLOT_AVAILABLE ((uint32_t) -1) // 0xFFFFFFFF - invalid slot
+// A slot is the sector a swapped page starts at, a page entry keeps it in its 20 frame address bits
+#define DISK_SWAP_SLOTS_LIMIT (1u << 20)
 // Register offsets from the base I/O port
 #define ATA_REG_DATA          0x0
 #define ATA_REG_ERR           0x1 // Error register (read) / Features register (write)
@@ -43,6 +45,21 @@
 #define MAX_SECTORS_PER_CALL_SIZE  256
 #define ATA_PIO_MAX_SECTORS_PER_CMD 0
 
+// Master Boot Record partition table
+#define MBR_PARTITIONS_OFFSET     446
+#define MBR_PARTITIONS_COUNT      4
+#define MBR_SIGNATURE_OFFSET      510
+#define MBR_PARTITION_TYPE_SWAP   0x82 // Linux swap
+
+typedef struct {
+    uint8_t status;
+    uint8_t first_chs[3];
+    uint8_t type;
+    uint8_t last_chs[3];
+    uint32_t first_lba;
+    uint32_t sector_count;
+} __attribute__((packed)) mbr_partition_t;
+
 // Identify Device Data Structure
 typedef struct {
     uint16_t general_config;
@@ -101,18 +118,50 @@ void test_disk_driver();
 
 void switch_disk(uint8_t disk_num);
 
-uint32_t disk_alloc_slots(uint8_t slots_num);
+/*
+ * Makes [first_sector, first_sector + sector_count) of the current disk the swap area, clipped to the disk and to
+ * DISK_SWAP_SLOTS_LIMIT. The slots of the previous area are forgotten.
+ * return true if the area holds at least one page
+ */
+bool disk_set_swap_area(uint32_t first_sector, uint32_t sector_count);
+
+/*
+ * Sets the swap area of the current disk - its Linux swap partition if the MBR has one, the whole disk after its
+ * first page otherwise. Needs the pmm, the metadata of the area is taken from the DMA zone.
+ * return true if there is a swap area
+ */
+bool disk_init_swap_area();
+
+/*
+ * Allocates contiguous slots (sectors) in the swap area, rounded up to whole pages, with a single reference.
+ * return the first slot or DISK_NO_SLOT_AVAILABLE
+ */
+uint32_t disk_alloc_slots(uint32_t slots_num);
 
 static inline uint32_t disk_alloc_slot() {
     return disk_alloc_slots(1);
 }
 
+// Takes another reference on allocated slots, e.g. for a swapped out page that is shared by a fork
+void disk_get_slots(uint32_t slot, uint32_t slots_num);
+
 void disk_free_slot(uint32_t slot);
 
-void disk_free_slots(uint32_t slot, uint8_t slots_num);
+// Drops a reference of the slots, the slots whose last reference is dropped are freed
+void disk_free_slots(uint32_t slot, uint32_t slots_num);
+
+// Returns the amount of free slots in the swap area
+size_t disk_get_swap_free_slots();
 
 size_t disk_write(uint32_t lba, const void *buffer, const size_t len);
 
+/*
+ * Writes len bytes, a multiple of the sector size, straight from the buffer without a bounce buffer.
+ * The buffer must stay mapped until the write is done, e.g. an arena buffer - not memory that can be swapped out.
+ * Returns the number of bytes written, 0 if len is not a multiple of the sector size.
+ */
+size_t disk_write_direct(uint32_t lba, const void *buffer, size_t len);
+
 size_t disk_read(uint32_t addr, void *buffer, const size_t len);
 size_t disk_get_current_disk_logical_sector_size();
 
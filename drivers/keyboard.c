@@ -7,6 +7,7 @@
 #include "io.h"
 #include "screen.h"
 #include "../interupts/pic.h"
+#include "../kernel.h"
 
 static char keyboard_buffer[BUFFER_SIZE] = {0};
 static volatile uint8_t buffer_head = 0;
@@ -96,7 +97,9 @@ void set_put_on_screen(bool value)
 }
 
 char keyboard_buffer_get() {
-    while(is_keyboard_buffer_Empty());
+    // Waiting for the user is idle time
+    while(is_keyboard_buffer_Empty())
+        kernel_idle();
     char c = keyboard_buffer[buffer_tail];
     buffer_tail = (buffer_tail + 1) % BUFFER_SIZE;
     return c;
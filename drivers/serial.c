@@ -0,0 +1,48 @@
+//
+// Created by Yoav on 10/18/2026.
+//
+
+#include "serial.h"
+#include "io.h"
+
+void serial_init(void) {
+    outb(COM1 + 1, 0x00); // disable interrupts
+    outb(COM1 + 3, 0x80); // DLAB on
+    outb(COM1 + 0, 0x03); // 38400 baud divisor (lo)
+    outb(COM1 + 1, 0x00); // (hi)
+    outb(COM1 + 3, 0x03); // 8N1
+    outb(COM1 + 2, 0xC7); // FIFO enable/clear, 14-byte threshold
+    outb(COM1 + 4, 0x0B); // IRQs enabled, RTS/DSR set
+}
+
+static int serial_tx_empty(void) { return (inb(COM1 + 5) & 0x20) != 0; }
+
+static void serial_putc(char c) {
+    while (!serial_tx_empty()) {
+    }
+    outb(COM1, (uint8_t) c);
+}
+
+void serial_puts(const char *s) {
+    while (*s) {
+        if (*s == '\n') serial_putc('\r');
+        serial_putc(*s++);
+    }
+}
+
+void serial_put_uint(uint32_t num) {
+    char digits[10];
+    int count = 0;
+    do {
+        digits[count++] = (char) ('0' + num % 10);
+        num /= 10;
+    } while (num != 0);
+    while (count > 0)
+        serial_putc(digits[--count]);
+}
+
+void serial_put_hexa(uint32_t num) {
+    serial_puts("0x");
+    for (int shift = 28; shift >= 0; shift -= 4)
+        serial_putc("0123456789ABCDEF"[(num >> shift) & 0xF]);
+}
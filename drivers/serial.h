@@ -0,0 +1,21 @@
+//
+// Created by Yoav on 10/18/2026.
+//
+
+/**
+ * Minimal driver for the COM1 serial port, it is mirrored to the CLI with qemu -serial stdio.
+ * Output only - used for the test results and the debug dumps.
+ */
+#ifndef MYKERNEL_SERIAL_H
+#define MYKERNEL_SERIAL_H
+
+#include "../std/stdint.h"
+
+#define COM1 0x3F8
+
+void serial_init(void);
+void serial_puts(const char *s);
+void serial_put_uint(uint32_t num);
+void serial_put_hexa(uint32_t num); // with 0x prefix
+
+#endif //MYKERNEL_SERIAL_H
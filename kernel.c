@@ -6,12 +6,24 @@
 #include "interupts/pic.h"
 #include "gdt.h"
 #include "drivers/disk.h"
+#include "drivers/serial.h"
 #include "memory/pmm.h"
 #include "memory/vmm.h"
 #include "memory/kmalloc.h"
+#include "memory/page_replacement.h"
+#include "memory/kswapd.h"
 #include "std/string.h"
 #include "std/stdio.h"
 #include "processes/process.h"
+#include "multiboot.h"
+#include "errors.h"
+#include "kernel.h"
+#ifdef RUN_TESTS
+#include "tests/test_framework.h"
+#endif
+#ifdef RUN_BENCHMARKS
+#include "tests/pmm_bench.h"
+#endif
 
 
 void test_kmalloc() {
@@ -30,25 +42,69 @@ void test_pmm() {
     printf("Freed frame at: %p\n", addr);
 }
 
-void kernel_main() {
+/*
+ * Returns the value of a "key=value" word of the kernel command line, or NULL if the key isn't there.
+ * The value ends at the next space, so it's copied to value (up to max_len - 1 characters)
+ */
+static const char *boot_option(const multiboot_info_t *multiboot_info, const char *key, char *value, int max_len) {
+    if (!(multiboot_info->flags & MULTIBOOT_INFO_CMDLINE))
+        return NULL;
+    const int key_len = strlen(key);
+    for (const char *word = (const char *) multiboot_info->cmdline; *word != '\0'; word++) {
+        const bool word_start = word == (const char *) multiboot_info->cmdline || word[-1] == ' ';
+        if (!word_start || strncmp(word, key, key_len) != 0 || word[key_len] != '=')
+            continue;
+        int i = 0;
+        for (const char *c = word + key_len + 1; *c != '\0' && *c != ' ' && i < max_len - 1; c++)
+            value[i++] = *c;
+        value[i] = '\0';
+        return value;
+    }
+    return NULL;
+}
+
+void kernel_idle() {
+    // A round at a time, so a key that arrives meanwhile is handled soon
+    if (kswapd_run(KSWAPD_IDLE_BUDGET) == 0)
+        pmm_zero_free_frames(1);
+}
+
+void kernel_main(uint32_t multiboot_magic, const multiboot_info_t *multiboot_info) {
+    if (multiboot_magic != MULTIBOOT_BOOTLOADER_MAGIC)
+        panic("Not loaded by a multiboot bootloader, so there is no memory map to work with");
+    // e.g. "replacement=2q", read before paging is enabled, the command line is at a physical address
+    char replacement[16];
+    const bool unknown_replacement = boot_option(multiboot_info, "replacement", replacement, sizeof(replacement)) &&
+                                     !page_replacement_select(replacement);
     init_gdt();
     init_idt();
     remap_pic();
+    serial_init(); // COM1 carries the test results and the heapprof dump
     init_disk_driver();
-    pmm_init();
+    pmm_init(multiboot_info);
     vmm_init();
+    const bool has_swap = disk_init_swap_area();
     init_kmalloc();
     //    processes_init();
     asm volatile("sti"); // enable interrupts
 
     clear_screen();
     printf("Kernel loaded successfully. its yoav kernel\n");
+    if (unknown_replacement)
+        printf("Unknown page replacement policy %s, ", replacement);
+    printf("Page replacement policy: %s\n", page_replacement_current()->name);
+    if (has_swap)
+        printf("Swap area: %d free slots\n", disk_get_swap_free_slots());
+    else
+        printf("No swap area, pages can't be swapped out\n");
+#ifdef RUN_BENCHMARKS
+    run_pmm_bench();
+#endif
 #ifdef RUN_TESTS
-#include "tests/disk_tests.h"
     printf("testing\n");
     // test_pmm();
     // test_kmalloc();
-    run_disk_tests();
+    run_all_tests();
 #else
     shell();
 #endif
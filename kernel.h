@@ -0,0 +1,14 @@
+//
+// Created by Yoav on 10/18/2026.
+//
+
+#ifndef MYKERNELPROJECT_KERNEL_H
+#define MYKERNELPROJECT_KERNEL_H
+
+/*
+ * Does a round of the background memory work - kswapd reclaim, or zeroing a frame for pmm_alloc_zeroed_frame
+ * when there is nothing to reclaim. Called in a loop by whatever waits with nothing else to run.
+ */
+void kernel_idle();
+
+#endif //MYKERNELPROJECT_KERNEL_H
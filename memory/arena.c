@@ -0,0 +1,116 @@
+//
+// Created by Yoav on 10/18/2026.
+//
+
+#include "arena.h"
+#include "../std/stdbool.h"
+#include "../std/assert.h"
+
+#define ALIGN_UP(x, align) (((x) + (align) - 1) & ~((align) - 1))
+
+struct arena_chunk {
+    arena_chunk_t *next; // The chunk before it in the arena, or the next free chunk
+    size_t order;        // The chunk is 2^order frames
+};
+
+#define CHUNK_HEADER_SIZE ALIGN_UP(sizeof(arena_chunk_t), ARENA_ALIGN)
+
+static arena_t scratch_arena = {NULL, NULL, 0};
+static bool scratch_shrinker_registered = false;
+
+// ---------------------------- Helper functions ----------------------------
+
+static inline size_t chunk_capacity(const arena_chunk_t *chunk) {
+    return ((size_t) PMM_BLOCK_SIZE << chunk->order) - CHUNK_HEADER_SIZE;
+}
+
+static inline uint8_t *chunk_data(arena_chunk_t *chunk) {
+    return (uint8_t *) chunk + CHUNK_HEADER_SIZE;
+}
+
+// Returns a chunk that holds at least size bytes, a free one if there is one big enough
+static arena_chunk_t *get_chunk(arena_t *arena, size_t size) {
+    for (arena_chunk_t **link = &arena->free_chunks; *link != NULL; link = &(*link)->next) {
+        arena_chunk_t *chunk = *link;
+        if (chunk_capacity(chunk) >= size) {
+            *link = chunk->next;
+            return chunk;
+        }
+    }
+
+    uint8_t order = buddy_order_of((size + CHUNK_HEADER_SIZE + PMM_BLOCK_SIZE - 1) / PMM_BLOCK_SIZE);
+    if (order < ARENA_CHUNK_ORDER)
+        order = ARENA_CHUNK_ORDER;
+    // The DMA zone is identity mapped, so the physical address of the chunk is also its virtual address
+    const physical_addr frames = pmm_alloc_frames_zone(ZONE_DMA, order);
+    if (frames == PMM_NO_FRAME_AVAILABLE)
+        return NULL;
+    arena_chunk_t *chunk = (arena_chunk_t *) frames;
+    chunk->order = order;
+    return chunk;
+}
+
+static size_t scratch_shrink(size_t frames_wanted) {
+    (void) frames_wanted; // the free chunks are not worth keeping when memory is low
+    return arena_trim(&scratch_arena);
+}
+
+// ---------------------------- Arena functions ----------------------------
+
+void arena_init(arena_t *arena) {
+    assert(arena != NULL);
+    arena->chunks = NULL;
+    arena->free_chunks = NULL;
+    arena->used = 0;
+}
+
+void *arena_alloc(arena_t *arena, size_t size) {
+    size = ALIGN_UP(size, ARENA_ALIGN);
+    if (arena->chunks == NULL || arena->used + size > chunk_capacity(arena->chunks)) {
+        arena_chunk_t *chunk = get_chunk(arena, size);
+        if (chunk == NULL)
+            return NULL;
+        chunk->next = arena->chunks;
+        arena->chunks = chunk;
+        arena->used = 0;
+    }
+    void *ptr = chunk_data(arena->chunks) + arena->used;
+    arena->used += size;
+    return ptr;
+}
+
+arena_scope_t arena_begin(const arena_t *arena) {
+    const arena_scope_t scope = {.chunk = arena->chunks, .used = arena->used};
+    return scope;
+}
+
+void arena_end(arena_t *arena, arena_scope_t scope) {
+    // The chunks that were started in the scope go to the free chunks as a whole
+    while (arena->chunks != scope.chunk) {
+        assert(arena->chunks != NULL); // the scope is not of this arena or it already ended
+        arena_chunk_t *chunk = arena->chunks;
+        arena->chunks = chunk->next;
+        chunk->next = arena->free_chunks;
+        arena->free_chunks = chunk;
+    }
+    arena->used = scope.used;
+}
+
+size_t arena_trim(arena_t *arena) {
+    size_t freed = 0;
+    while (arena->free_chunks != NULL) {
+        arena_chunk_t *chunk = arena->free_chunks;
+        arena->free_chunks = chunk->next;
+        freed += (size_t) 1 << chunk->order;
+        pmm_free_frames((physical_addr) chunk, chunk->order);
+    }
+    return freed;
+}
+
+arena_t *arena_scratch() {
+    if (!scratch_shrinker_registered) {
+        pmm_register_shrinker(scratch_shrink);
+        scratch_shrinker_registered = true;
+    }
+    return &scratch_arena;
+}
@@ -0,0 +1,60 @@
+//
+// Created by Yoav on 10/18/2026.
+//
+
+/*
+ * Arena allocator for short lived kernel buffers.
+ * An arena hands out memory by bumping a pointer in chunks of frames from the DMA zone. The DMA zone is
+ * identity mapped, so a chunk needs no mapping and its buffers can be given to a DMA capable controller.
+ * Nothing is freed on its own - arena_begin opens a scope and arena_end frees everything that was allocated
+ * since, in O(1). The chunks are kept for the next scopes until arena_trim gives them back to the pmm.
+ */
+
+#ifndef MYKERNEL_ARENA_H
+#define MYKERNEL_ARENA_H
+
+#include "../std/stdint.h"
+#include "pmm.h"
+
+#define ARENA_CHUNK_ORDER 6u // 256KB chunks, a full 128KB disk transfer fits in one next to the chunk header
+#define ARENA_ALIGN 16u      // alignment of every allocation
+
+typedef struct arena_chunk arena_chunk_t;
+
+typedef struct {
+    arena_chunk_t *chunks;      // The chunks in use, the current one first
+    arena_chunk_t *free_chunks; // Chunks that were used by a scope that ended
+    size_t used;                // Bytes used in the current chunk
+} arena_t;
+
+// A point in the arena to go back to, see arena_begin
+typedef struct {
+    arena_chunk_t *chunk;
+    size_t used;
+} arena_scope_t;
+
+void arena_init(arena_t *arena);
+
+/*
+ * Allocates size bytes aligned to ARENA_ALIGN, the memory lives until the scope it was allocated in ends.
+ * return the memory or NULL if there are no frames for a new chunk
+ */
+void *arena_alloc(arena_t *arena, size_t size);
+
+arena_scope_t arena_begin(const arena_t *arena);
+// Frees everything that was allocated since the matching arena_begin, scopes must end in reverse order
+void arena_end(arena_t *arena, arena_scope_t scope);
+
+/*
+ * Gives the chunks that no scope uses back to the pmm.
+ * return the amount of frames given back
+ */
+size_t arena_trim(arena_t *arena);
+
+/*
+ * The scratch arena of the running CPU, for buffers that don't outlive the function that allocates them.
+ * There is a single CPU, so there is a single scratch arena. Its free chunks are given back under memory pressure.
+ */
+arena_t *arena_scratch();
+
+#endif //MYKERNEL_ARENA_H
@@ -0,0 +1,155 @@
+//
+// Created by Yoav on 10/18/2026.
+//
+
+#include "buddy.h"
+#include "../std/assert.h"
+
+// ---------------------------- Helper functions ----------------------------
+
+static inline size_t blocks_in_order(const buddy_t *buddy, uint8_t order) {
+    // A partial block at the end of the range can never be free, so it is not tracked
+    return buddy->units >> order;
+}
+
+static inline bool is_block_free(const buddy_t *buddy, uint8_t order, size_t index) {
+    return summary_bitmap_test(&buddy->free_map[order], index);
+}
+
+static inline void add_free_block(buddy_t *buddy, uint8_t order, size_t index) {
+    summary_bitmap_set(&buddy->free_map[order], index);
+    buddy->free_blocks[order]++;
+}
+
+static inline void remove_free_block(buddy_t *buddy, uint8_t order, size_t index) {
+    summary_bitmap_clear(&buddy->free_map[order], index);
+    buddy->free_blocks[order]--;
+}
+
+// Returns the index of a free block of the given order, the order must have at least one free block
+static size_t find_free_block(const buddy_t *buddy, uint8_t order) {
+    const size_t index = summary_bitmap_find_first(&buddy->free_map[order]);
+    assert(index != SUMMARY_BITMAP_NONE); // free_blocks said there is a free block
+    return index;
+}
+
+/*
+ * Finds the free block that contains the unit.
+ * return true and fills the order of the block if found, false if the unit is used
+ */
+static bool find_block_containing(const buddy_t *buddy, size_t unit, uint8_t *order) {
+    for (uint8_t k = 0; k <= BUDDY_MAX_ORDER; k++) {
+        if (is_block_free(buddy, k, unit >> k)) {
+            *order = k;
+            return true;
+        }
+    }
+    return false;
+}
+
+// ---------------------------- Buddy functions ----------------------------
+
+void buddy_init(buddy_t *buddy, size_t units, uint32_t *metadata) {
+    assert(buddy != NULL && metadata != NULL);
+    buddy->units = units;
+    buddy->free_units = 0;
+    for (uint8_t order = 0; order <= BUDDY_MAX_ORDER; order++) {
+        metadata += summary_bitmap_init(&buddy->free_map[order], blocks_in_order(buddy, order), metadata);
+        buddy->free_blocks[order] = 0;
+    }
+}
+
+size_t buddy_alloc(buddy_t *buddy, uint8_t order) {
+    if (order > BUDDY_MAX_ORDER)
+        return BUDDY_NO_BLOCK;
+
+    uint8_t k = order;
+    while (k <= BUDDY_MAX_ORDER && buddy->free_blocks[k] == 0)
+        k++;
+    if (k > BUDDY_MAX_ORDER)
+        return BUDDY_NO_BLOCK;
+
+    size_t index = find_free_block(buddy, k);
+    remove_free_block(buddy, k, index);
+
+    // Split the block until it has the right size, the upper halves stay free
+    while (k > order) {
+        k--;
+        index <<= 1;
+        add_free_block(buddy, k, index | 1);
+    }
+
+    buddy->free_units -= (size_t) 1 << order;
+    return index << order;
+}
+
+void buddy_free(buddy_t *buddy, size_t first, uint8_t order) {
+    assert(order <= BUDDY_MAX_ORDER);
+    assert((first & (((size_t) 1 << order) - 1)) == 0);
+    assert(first + ((size_t) 1 << order) <= buddy->units);
+
+    buddy->free_units += (size_t) 1 << order;
+
+    // Merge with the buddy as long as it is free
+    size_t index = first >> order;
+    while (order < BUDDY_MAX_ORDER && is_block_free(buddy, order, index ^ 1)) {
+        remove_free_block(buddy, order, index ^ 1);
+        index >>= 1;
+        order++;
+    }
+    add_free_block(buddy, order, index);
+}
+
+void buddy_free_range(buddy_t *buddy, size_t first, size_t count) {
+    if (first >= buddy->units)
+        return;
+    if (count > buddy->units - first)
+        count = buddy->units - first;
+
+    // Free the biggest aligned blocks that fit
+    while (count > 0) {
+        uint8_t order = BUDDY_MAX_ORDER;
+        while (order > 0 && ((first & (((size_t) 1 << order) - 1)) || ((size_t) 1 << order) > count))
+            order--;
+        buddy_free(buddy, first, order);
+        first += (size_t) 1 << order;
+        count -= (size_t) 1 << order;
+    }
+}
+
+void buddy_reserve_range(buddy_t *buddy, size_t first, size_t count) {
+    if (first >= buddy->units)
+        return;
+    size_t end = (count > buddy->units - first) ? buddy->units : first + count;
+
+    size_t unit = first;
+    while (unit < end) {
+        uint8_t order;
+        if (!find_block_containing(buddy, unit, &order)) {
+            unit++;
+            continue;
+        }
+        const size_t block = (unit >> order) << order;
+        const size_t block_end = block + ((size_t) 1 << order);
+        remove_free_block(buddy, order, block >> order);
+        buddy->free_units -= (size_t) 1 << order;
+
+        // Give back the parts of the block that are outside the reserved range
+        if (block < unit)
+            buddy_free_range(buddy, block, unit - block);
+        if (block_end > end)
+            buddy_free_range(buddy, end, block_end - end);
+        unit = block_end;
+    }
+}
+
+bool buddy_is_free(const buddy_t *buddy, size_t unit) {
+    uint8_t order;
+    return unit < buddy->units && find_block_containing(buddy, unit, &order);
+}
+
+bool buddy_is_free_block(const buddy_t *buddy, size_t first, uint8_t order) {
+    uint8_t free_order;
+    // Blocks are aligned, so a free block of at least this order that holds first holds the whole block
+    return first < buddy->units && find_block_containing(buddy, first, &free_order) && free_order >= order;
+}
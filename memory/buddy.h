@@ -0,0 +1,76 @@
+//
+// Created by Yoav on 10/18/2026.
+//
+
+/*
+ * Binary buddy allocator over an abstract range of equally sized units (frames, pages, ...).
+ * A block of order k is 2^k units and is aligned to its own size.
+ * For every order there is a summary bitmap (see summary_bitmap.h) where bit i set means
+ * "block i of this order is free (and is not part of a bigger free block)", so finding a free
+ * block is a few bit scans.
+ * The allocator never touches the memory it manages, so it can manage memory that is not mapped.
+ */
+
+#ifndef MYKERNEL_BUDDY_H
+#define MYKERNEL_BUDDY_H
+
+#include "../std/stdint.h"
+#include "../std/stdbool.h"
+#include "summary_bitmap.h"
+
+#define BUDDY_MAX_ORDER 10u // 2^10 units - a 4MB block when the unit is a 4KB frame
+#define BUDDY_NO_BLOCK ((size_t) -1)
+
+// Upper bound of the amount of 32 bit words of metadata needed to manage `units` units
+// (the orders together have less than 2 * units blocks)
+#define BUDDY_METADATA_WORDS(units) (SUMMARY_BITMAP_WORDS(2u * (units)) + SUMMARY_BITMAP_LEVELS * (BUDDY_MAX_ORDER + 1u))
+
+typedef struct {
+    size_t units;                                // Amount of units managed
+    size_t free_units;                           // Amount of units that are free
+    summary_bitmap_t free_map[BUDDY_MAX_ORDER + 1]; // Per order bitmap of the free blocks
+    size_t free_blocks[BUDDY_MAX_ORDER + 1];        // Per order amount of free blocks
+} buddy_t;
+
+/*
+ * Initializes the buddy allocator with all the units marked as used.
+ * @param metadata storage of at least BUDDY_METADATA_WORDS(units) words, it doesn't have to be zeroed
+ */
+void buddy_init(buddy_t *buddy, size_t units, uint32_t *metadata);
+
+/*
+ * Marks [first, first + count) as free, merging with the free neighbours.
+ */
+void buddy_free_range(buddy_t *buddy, size_t first, size_t count);
+
+/*
+ * Marks [first, first + count) as used. Units that are already used are skipped.
+ */
+void buddy_reserve_range(buddy_t *buddy, size_t first, size_t count);
+
+/*
+ * Allocates a block of 2^order units.
+ * @return the first unit of the block or BUDDY_NO_BLOCK if there is no free block big enough
+ */
+size_t buddy_alloc(buddy_t *buddy, uint8_t order);
+
+/*
+ * Frees a block that was allocated with buddy_alloc (or a sub block of it).
+ * @param first the first unit of the block, must be aligned to 2^order
+ */
+void buddy_free(buddy_t *buddy, size_t first, uint8_t order);
+
+bool buddy_is_free(const buddy_t *buddy, size_t unit);
+
+// Returns true if the whole block of 2^order units at first is free, first must be aligned to 2^order
+bool buddy_is_free_block(const buddy_t *buddy, size_t first, uint8_t order);
+
+// Returns the smallest order that holds `count` units
+static inline uint8_t buddy_order_of(size_t count) {
+    uint8_t order = 0;
+    while (((size_t) 1 << order) < count)
+        order++;
+    return order;
+}
+
+#endif //MYKERNEL_BUDDY_H
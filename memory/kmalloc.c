@@ -5,6 +5,19 @@
 /*
  * This file is a basic implementation of a kernel memory allocator.
  * Its base on slab allocator.
+ * Every cache keeps its slabs on three lists - partial, full and empty - and a slab moves between them when
+ * objects are allocated and freed, so an allocation takes the first partial slab in O(1) and full slabs
+ * are never visited.
+ * The slabs live in the heap window [KERNEL_BASE_HEAP_ADDR, +KERNEL_HEAP_SIZE). The heap grows one slab at a
+ * time - a slab is any frame from the pmm mapped to a free slot of the window - and empty slabs are given back
+ * to the pmm when it runs out of memory (see kmalloc_shrink).
+ * Next to the size classes of kmalloc, a module can create a cache of its own type (kmem_cache_create), so the
+ * objects are packed by their real size and can be constructed once per slab instead of once per allocation.
+ * The space a slab has left after its objects is used to color it - the first object of every new slab is a
+ * cache line further than in the slab before it - so the hot objects of different slabs don't all compete on
+ * the same cache sets.
+ * Built with KMALLOC_PROFILE, every kmalloc is charged to its call site (the return address) and size class,
+ * so the sites that hold the most memory can be dumped from the shell or over serial (kmalloc_profile_dump).
  */
 
 
@@ -14,131 +27,113 @@
 #include "pmm.h"
 #include "../errors.h"
 #include "vmm.h"
-
-
-#define MIN_NUM_HEAPS 4
-uint32_t KERNEL_BASE_HEAP_ADDR;
-static uint32_t current_heap_addr = 0;
-static uint32_t current_large_heap_addr = 0;
-// this values represents the start of the kernel heap address
-static const int MIN_SIZE = 16;
+#include "summary_bitmap.h"
+#include "buddy.h"
+#include "utills.h"
+#include "../std/stdio.h"
+#include "../drivers/serial.h"
+
+
+#define HEAP_SLOTS (KERNEL_HEAP_SIZE / PMM_BLOCK_SIZE)
+#define ALIGN_UP(x, align) (((x) + (align) - 1) & ~((align) - 1))
+// Bit i set means slot i of the heap window is not mapped to a slab
+static summary_bitmap_t free_heap_slots;
+static uint32_t free_heap_slots_storage[SUMMARY_BITMAP_WORDS(HEAP_SLOTS)];
+#define LARGE_HEAP_PAGES (KERNEL_LARGE_HEAP_SIZE / PMM_BLOCK_SIZE)
+#define LARGE_NO_ALLOC ((size_t) -1)
+// The pages of the large heap window, every large allocation is a run of pages taken from a buddy block
+static buddy_t large_heap;
+static uint32_t large_heap_metadata[BUDDY_METADATA_WORDS(LARGE_HEAP_PAGES)];
+// The amount of pages of the allocation that starts at every page of the window, 0 if none starts there
+static uint16_t large_alloc_pages[LARGE_HEAP_PAGES];
+
+#ifdef KMALLOC_PROFILE
+#define SLAB_SITES_SIZE (PMM_BLOCK_SIZE / KMALLOC_ALIGN)
+// The sites of the call sites table, index 0 collects the sites that didn't fit
+static kmalloc_site_stats_t profile_sites[KMALLOC_PROFILE_SITES];
+// The site of the allocation that starts at every page of the large heap window
+static uint8_t large_alloc_sites[LARGE_HEAP_PAGES];
+#else
+#define SLAB_SITES_SIZE 0
+#endif
+
+struct cache;
 
 struct slab {
     size_t object_size;      // Size of objects in this slab
     void *free_list;         // Pointer to the first free object
-    size_t offset;           // Offset to the next free object
+    size_t num_objects;      // Number of objects the slab holds
     size_t free_count;       // Number of free objects
-    struct slab *next;       // Pointer to the next slab
-    uint8_t data[PMM_BLOCK_SIZE -  sizeof(size_t) - sizeof(void *) - 2 * sizeof(size_t) - sizeof(struct slab *)];
+    struct slab *next;       // Pointer to the next slab in the list of its state
+    struct slab *prev;       // Pointer to the previous slab in the list of its state
+    struct cache *cache;     // The cache the slab belongs to
+    size_t state;            // The list the slab is on, a slab_state_t
+#ifdef KMALLOC_PROFILE
+    uint8_t sites[SLAB_SITES_SIZE]; // The site of every object, by its offset in the slab / KMALLOC_ALIGN
+#endif
+    uint8_t data[PMM_BLOCK_SIZE - 4 * sizeof(size_t) - sizeof(void *) - 2 * sizeof(struct slab *) - sizeof(struct cache *)
+                 - SLAB_SITES_SIZE];
 };
 
 struct cache {
-    size_t object_size;      // Size of objects in this cache
-    struct slab *slabs;      // Linked list of slabs
+    const char *name;                // Name of the cache, for debugging
+    size_t object_size;              // Size of objects in this cache
+    size_t stride;                   // Distance between two objects in a slab
+    size_t align;                    // Alignment of the objects, a power of two
+    size_t link_offset;              // Where a free object keeps the pointer to the next free object
+    kmem_ctor_t ctor;                // Constructor of the objects, NULL if there is none
+    size_t color;                    // Offset of the objects of the next slab, see init_slab
+    size_t allocations;              // kmalloc calls served by the cache
+    uint64_t requested_bytes;        // Bytes those kmalloc calls asked for
+    struct slab *slabs[SLAB_STATES]; // The slabs of every state
+    size_t slabs_count[SLAB_STATES]; // Amount of slabs of every state
 };
 
-typedef struct large_alloc {
-    size_t size;             // Size of the allocation
-    void *ptr;              // Pointer to the allocated memory
-    struct large_alloc *next; // Pointer to the next large allocation
-    struct large_alloc *prev; // Pointer to the previous large allocation
-
-} large_alloc_t;
-
-static large_alloc_t *large_allocations = NULL; // Linked list of large allocations
-
-static large_alloc_t *create_large_alloc(size_t size, void *ptr) {
-	large_alloc_t *alloc = (large_alloc_t *) kmalloc(sizeof(large_alloc_t));
-    if (alloc == NULL) {
-       	panic("Failed to allocate memory for large allocation");
-        return NULL;
-    }
-    alloc->size = size;
-    alloc->ptr = ptr;
-    alloc->next = NULL;
-    alloc->prev = NULL;
-    return alloc;
-}
-//Asumes that the large allocation is not already in the list and that ptr is already freed
-static void large_alloc_destroy(large_alloc_t *alloc) {
-    if (alloc == NULL) {
-        return;
-    }
-    //Does not free beacuse its already freeed
-    kfree(alloc);
-}
-
+#define SIZE_CLASS(size) {.name = "kmalloc-" #size, .object_size = size, .stride = size, .align = sizeof(void *)}
 
+// The size classes of kmalloc come first, the caches made by kmem_cache_create follow them
+static struct cache caches[NUM_CACHES + KMEM_MAX_CACHES] = {
+        SIZE_CLASS(16), SIZE_CLASS(32), SIZE_CLASS(48), SIZE_CLASS(64),
+        SIZE_CLASS(80), SIZE_CLASS(96), SIZE_CLASS(112), SIZE_CLASS(128),
+        SIZE_CLASS(160), SIZE_CLASS(192), SIZE_CLASS(224), SIZE_CLASS(256),
+        SIZE_CLASS(320), SIZE_CLASS(384), SIZE_CLASS(448), SIZE_CLASS(512),
+        SIZE_CLASS(640), SIZE_CLASS(768), SIZE_CLASS(896), SIZE_CLASS(1024),
+        SIZE_CLASS(1280), SIZE_CLASS(1536), SIZE_CLASS(1792), SIZE_CLASS(2048)
+};
+static size_t caches_count = NUM_CACHES;
 
-static void insert_large_alloc(large_alloc_t *alloc) {
-    if (large_allocations == NULL)
-        large_allocations = alloc;
-    else {
-        large_alloc_t *current = large_allocations;
-        current->prev = alloc;
-        alloc->next = current;
-        large_allocations = alloc;
-    }
+// The size class of every size, indexed by the size rounded up to KMALLOC_ALIGN. Filled by init_kmalloc
+static uint8_t size_class_index[MAX_CACHE_SIZE / KMALLOC_ALIGN + 1];
 
+// Offset of the first object from the start of the slab
+static inline size_t slab_first_object_offset(const struct cache *cache) {
+    return ALIGN_UP(sizeof(struct slab) - sizeof(((struct slab *) 0)->data), cache->align);
 }
 
-static void large_alloc_remove(large_alloc_t *alloc) {
-    if (alloc == NULL)
-        return;
-
-    if (alloc->prev != NULL)
-        alloc->prev->next = alloc->next;
-    else
-        large_allocations = alloc->next;
-    if (alloc->next != NULL)
-        alloc->next->prev = alloc->prev;
-	alloc->next = NULL;
-    alloc->prev = NULL;
-    alloc->ptr = NULL;
-    large_alloc_destroy(alloc);
-}
-
-static large_alloc_t *get_large_alloc_by_ptr(void *ptr) {
-    large_alloc_t *current = large_allocations;
-    while (current != NULL) {
-        if (current->ptr == ptr) {
-            return current;
-        }
-        current = current->next;
-    }
-    return NULL;
+static inline void **object_link(const struct cache *cache, void *object) {
+    return (void **) ((uint8_t *) object + cache->link_offset);
 }
 
+static void init_slab(struct slab *slab, struct cache *cache) {
+    const size_t first_offset = slab_first_object_offset(cache);
+    const size_t num_objects = (PMM_BLOCK_SIZE - first_offset) / cache->stride;
 
-static struct cache caches[NUM_CACHES] = {
-        {16, NULL},
-        {32, NULL},
-        {64, NULL},
-        {128, NULL},
-        {256, NULL},
-        {512, NULL},
-        {1024, NULL},
-        {2048, NULL}
-};
-
-
-static void *convert_to_vir_addr(physical_addr addr) {
-    return (void *) (addr + KERNEL_BASE_HEAP_ADDR);
-}
-
+    // Color the slab with the space that is left after the objects, it wraps around when it runs out
+    const size_t leftover = PMM_BLOCK_SIZE - first_offset - num_objects * cache->stride;
+    if (cache->color > leftover)
+        cache->color = 0;
+    uint8_t *const first = (uint8_t *) slab + first_offset + cache->color;
+    cache->color += cache->align > KMALLOC_CACHE_LINE ? cache->align : KMALLOC_CACHE_LINE;
 
-static void init_slab(struct slab *slab, size_t object_size) {
-    size_t available_size = sizeof(slab->data);
-    size_t num_objects = available_size / object_size;
+    slab->num_objects = num_objects;
     slab->free_count = num_objects;
-    slab->free_list = slab->data;
-    void **current = (void **)slab->free_list;
-    for (size_t i = 1; i < num_objects; i++) {
-        void *next_obj = (void *)((uint8_t *)slab->data + i * object_size);
-        *current = next_obj;
-        current = (void **)next_obj;
+    slab->free_list = first;
+    for (size_t i = 0; i < num_objects; i++) {
+        void *object = first + i * cache->stride;
+        if (cache->ctor != NULL)
+            cache->ctor(object);
+        *object_link(cache, object) = i + 1 < num_objects ? first + (i + 1) * cache->stride : NULL;
     }
-    *current = NULL;  // End of free list
 }
 
 
@@ -147,160 +142,564 @@ void *alloc_from_slab(struct slab *slab) {
         return NULL;
     }
     void *object = slab->free_list;
-    slab->free_list = *(void **)object;
+    slab->free_list = *object_link(slab->cache, object);
     slab->free_count--;
     return object;
 }
 
+// ---------------------------- Slab lists ----------------------------
+
+static void cache_add_slab(struct cache *cache, struct slab *slab, slab_state_t state) {
+    slab->state = state;
+    slab->prev = NULL;
+    slab->next = cache->slabs[state];
+    if (slab->next != NULL)
+        slab->next->prev = slab;
+    cache->slabs[state] = slab;
+    cache->slabs_count[state]++;
+}
+
+static void cache_remove_slab(struct cache *cache, struct slab *slab) {
+    if (slab->prev != NULL)
+        slab->prev->next = slab->next;
+    else
+        cache->slabs[slab->state] = slab->next;
+    if (slab->next != NULL)
+        slab->next->prev = slab->prev;
+    slab->next = slab->prev = NULL;
+    cache->slabs_count[slab->state]--;
+}
+
+static inline slab_state_t get_slab_state(const struct slab *slab) {
+    if (slab->free_count == 0)
+        return SLAB_FULL;
+    return slab->free_count == slab->num_objects ? SLAB_EMPTY : SLAB_PARTIAL;
+}
+
+// Moves the slab to the list that matches its free count
+static void cache_update_slab(struct cache *cache, struct slab *slab) {
+    const slab_state_t state = get_slab_state(slab);
+    if (state == slab->state)
+        return;
+    cache_remove_slab(cache, slab);
+    cache_add_slab(cache, slab, state);
+}
+
 void slab_free(struct slab *slab, void *object){
-    *(void **)object = slab->free_list;
+    *object_link(slab->cache, object) = slab->free_list;
     slab->free_list = object;
     slab->free_count++;
+    cache_update_slab(slab->cache, slab);
 }
 
-struct slab *create_slab(size_t object_size){
-    assert(current_heap_addr <= KERNEL_BASE_HEAP_ADDR + KERNEL_HEAP_SIZE);
-    //todo handle alocation of not continous memory
-    physical_addr slab_phys_addr = current_heap_addr;
-    current_heap_addr += PMM_BLOCK_SIZE;
-    void *slab_vir_addr = convert_to_vir_addr(slab_phys_addr);
-    vmm_map_page_to_curr_dir(slab_vir_addr, slab_phys_addr, PAGE_WRITEABLE);
-
-    struct slab *slab = (struct slab *) slab_vir_addr;
-    slab->object_size = object_size;
-    slab->offset = 0;
-    slab->next = NULL;
-    init_slab(slab, object_size);
+struct slab *create_slab(struct cache *cache){
+    const size_t slot = summary_bitmap_find_first(&free_heap_slots);
+    if (slot == SUMMARY_BITMAP_NONE)
+        return NULL; // the heap is used up
+    const physical_addr frame = pmm_alloc_frame();
+    if (frame == PMM_NO_FRAME_AVAILABLE)
+        return NULL;
+    summary_bitmap_clear(&free_heap_slots, slot);
+    struct slab *slab = (struct slab *) (KERNEL_BASE_HEAP_ADDR + slot * PMM_BLOCK_SIZE);
+    vmm_map_page_to_curr_dir(slab, frame, PAGE_WRITEABLE);
+
+    slab->object_size = cache->object_size;
+    slab->cache = cache;
+    slab->next = slab->prev = NULL;
+    init_slab(slab, cache);
+    cache_add_slab(cache, slab, SLAB_EMPTY);
     return slab;
 }
 
-static struct cache *get_cache(size_t size) {
-    for (size_t i = 0; i < NUM_CACHES; i++) {
-        if (caches[i].object_size >= size) {
-            return &caches[i];
+// Unmaps the slab and gives its frame back to the pmm, the slab must be empty
+static void destroy_slab(struct slab *slab) {
+    assert(slab->free_count == slab->num_objects);
+    cache_remove_slab(slab->cache, slab);
+    vmm_unmap_page(slab);
+    summary_bitmap_set(&free_heap_slots, ((uint32_t) slab - KERNEL_BASE_HEAP_ADDR) / PMM_BLOCK_SIZE);
+}
+
+/*
+ * Shrinker of kmalloc, called by the pmm when it runs out of frames.
+ * Destroys the empty slabs of every cache except for KMALLOC_EMPTY_SLABS_RESERVE of them, so the next
+ * allocations of the cache don't need a new slab right away.
+ * @return the amount of frames given back to the pmm
+ */
+static size_t kmalloc_shrink(size_t frames_wanted) {
+    size_t freed = 0;
+    for (size_t i = 0; i < caches_count && freed < frames_wanted; i++) {
+        struct cache *cache = &caches[i];
+        while (cache->slabs_count[SLAB_EMPTY] > KMALLOC_EMPTY_SLABS_RESERVE && freed < frames_wanted) {
+            destroy_slab(cache->slabs[SLAB_EMPTY]);
+            freed++;
         }
     }
-    return NULL;
+    return freed;
 }
 
-static int8_t get_slab_index(size_t size)
-{
-    static const size_t block_sizes[] = {16, 32, 64, 128, 256, 512, 1024, 2048};
-    for (size_t i = 0; i < sizeof(block_sizes) / sizeof(block_sizes[0]); i++) {
-        if (size <= block_sizes[i]) {
-            return i;
-        }
+// The size must be at most MAX_CACHE_SIZE
+static inline struct cache *get_cache(size_t size) {
+    return &caches[size_class_index[(size + KMALLOC_ALIGN - 1) / KMALLOC_ALIGN]];
+}
+
+static void init_size_class_index() {
+    size_t cache_index = 0;
+    for (size_t i = 0; i < sizeof(size_class_index); i++) {
+        while (caches[cache_index].object_size < i * KMALLOC_ALIGN)
+            cache_index++;
+        size_class_index[i] = cache_index;
     }
-    return -1; // Not possible
 }
 
 
 void* alloc_from_cache(struct cache* cache)
 {
-    struct slab* curr_slab = cache->slabs;
-    struct slab *new_slab;  // Declaration moved to the top.
+    // Partial slabs first so the empty ones stay empty, then an empty slab and only then a new one
+    struct slab *slab = cache->slabs[SLAB_PARTIAL];
+    if (slab == NULL)
+        slab = cache->slabs[SLAB_EMPTY];
+    if (slab == NULL)
+        slab = create_slab(cache);
+    if (slab == NULL)
+        return NULL;
+
+    void *object = alloc_from_slab(slab);
+    cache_update_slab(cache, slab);
+    return object;
+}
+
+/*
+ * Backs the pages at vir_addr with a single run of physically contiguous frames.
+ * The buddy block is a power of two, so the frames after num_pages are given back right away.
+ * return true on success, false if there is no contiguous run big enough
+ */
+static bool kmalloc_large_map_contiguous(uint32_t vir_addr, size_t num_pages)
+{
+    const uint8_t order = buddy_order_of(num_pages);
+    if (order > PMM_MAX_ORDER)
+        return false;
+    const physical_addr base = pmm_alloc_frames(order);
+    if (base == PMM_NO_FRAME_AVAILABLE)
+        return false;
 
-    if (curr_slab == NULL)
-        goto failed_alloc_from_cache_create_new_slab;
-    while (curr_slab != NULL)
+    // Give back the tail in the biggest aligned pieces
+    for (size_t i = num_pages; i < ((size_t) 1 << order); i += (size_t) 1 << __builtin_ctz(i))
+        pmm_free_frames(base + i * PMM_BLOCK_SIZE, __builtin_ctz(i));
+
+    for (size_t i = 0; i < num_pages; i++)
+        vmm_map_page_to_curr_dir((void *)(vir_addr + i * PMM_BLOCK_SIZE), base + i * PMM_BLOCK_SIZE, PAGE_WRITEABLE);
+    return true;
+}
+
+/*
+ * Backs the pages at vir_addr with frames, contiguous ones if there are, otherwise frame by frame.
+ * return true on success, false if there are not enough frames (nothing stays mapped then)
+ */
+static bool kmalloc_large_map(uint32_t vir_addr, size_t num_pages)
+{
+    if (kmalloc_large_map_contiguous(vir_addr, num_pages))
+        return true;
+    // Fall back to frame by frame allocation when the memory is too fragmented
+    for(size_t i = 0; i < num_pages; i++)
     {
-        void *res = alloc_from_slab(curr_slab);
-        if (res != NULL)
-            return res;
-        curr_slab = curr_slab->next;
+      uint32_t page_addr = vir_addr + i * PMM_BLOCK_SIZE;
+      physical_addr addr = pmm_alloc_frame();
+        if (addr == PMM_NO_FRAME_AVAILABLE) {
+            // unmap the pages that were already allocated
+            for (size_t j = 0; j < i; j++)
+                vmm_unmap_page((void *)(vir_addr + j * PMM_BLOCK_SIZE));
+            return false;
+        }
+      vmm_map_page_to_curr_dir((void *)page_addr, addr, PAGE_WRITEABLE);//todo add the right flags
     }
+    return true;
+}
 
-    failed_alloc_from_cache_create_new_slab:
-    // Failed to allocate, so allocate a new slab.
-    new_slab = create_slab(cache->object_size);
-    if (new_slab == NULL)  // Check if slab creation failed.
-        return NULL;
-    new_slab->next = cache->slabs;
-    cache->slabs = new_slab;
-    return alloc_from_slab(new_slab);
+static inline size_t size_to_pages(size_t size) {
+    return size == 0 ? 1 : (size + PMM_BLOCK_SIZE - 1) / PMM_BLOCK_SIZE;
+}
+
+/*
+ * Takes num_pages pages that are bigger than a buddy block from consecutive free blocks of the biggest order.
+ * step_pages is the alignment of the first page, at least a block of the biggest order.
+ * return the first page or BUDDY_NO_BLOCK if there is no such run
+ */
+static size_t large_heap_alloc_run(size_t num_pages, size_t step_pages)
+{
+    const size_t block_pages = (size_t) 1 << BUDDY_MAX_ORDER;
+    for (size_t first_page = 0; first_page + num_pages <= LARGE_HEAP_PAGES; first_page += step_pages) {
+        size_t page = first_page;
+        while (page < first_page + num_pages && buddy_is_free_block(&large_heap, page, BUDDY_MAX_ORDER))
+            page += block_pages;
+        if (page >= first_page + num_pages) {
+            buddy_reserve_range(&large_heap, first_page, num_pages);
+            return first_page;
+        }
+    }
+    return BUDDY_NO_BLOCK;
 }
 
 /*
 * This function is called when the size is larger than the maximum cache size.
-* It round up the size to the nearest multiple of PMM_BLOCK_SIZE and al
+* It round up the size to the nearest multiple of PMM_BLOCK_SIZE and maps that many pages of the large heap window.
 * @param size The size of the memory to allocate.
+* @param align The alignment of the memory, a power of two. The memory is always page aligned
 * @return A pointer to the allocated memory, or NULL if allocation failed.
  */
-static void* kmalloc_large(size_t size)
+static void* kmalloc_large(size_t size, size_t align)
 {
-    size_t aligned_size = (size + PMM_BLOCK_SIZE - 1) & ~(PMM_BLOCK_SIZE - 1);
+    const size_t num_pages = size_to_pages(size);
+    // Buddy blocks are aligned to their size, so a block of the alignment is aligned as well
+    uint8_t order = buddy_order_of(num_pages);
+    if (align > PMM_BLOCK_SIZE && buddy_order_of(align / PMM_BLOCK_SIZE) > order)
+        order = buddy_order_of(align / PMM_BLOCK_SIZE);
+    size_t first_page;
+    if (order > BUDDY_MAX_ORDER) {
+        // Too big for one block, the run starts at a block of the biggest order or at the alignment
+        size_t step_pages = (size_t) 1 << BUDDY_MAX_ORDER;
+        if (align / PMM_BLOCK_SIZE > step_pages)
+            step_pages = align / PMM_BLOCK_SIZE;
+        first_page = large_heap_alloc_run(num_pages, step_pages);
+    } else {
+        first_page = buddy_alloc(&large_heap, order);
+        // Give back the pages after num_pages so the next allocations can use them
+        if (first_page != BUDDY_NO_BLOCK)
+            buddy_free_range(&large_heap, first_page + num_pages, ((size_t) 1 << order) - num_pages);
+    }
+    if (first_page == BUDDY_NO_BLOCK)
+        return NULL; // the window is used up or too fragmented
+    const uint32_t base = KERNEL_LARGE_HEAP_ADDR + first_page * PMM_BLOCK_SIZE;
 
-    for(size_t i = 0; i < aligned_size / PMM_BLOCK_SIZE; i++)
-    {
-      uint32_t vir_addr = current_large_heap_addr + i * PMM_BLOCK_SIZE;
-      physical_addr addr = pmm_alloc_frame();
-        if (addr == PMM_NO_FRAME_AVAILABLE) {
-           	// unmap the pages that were already allocated
-            for (size_t j = 0; j < i; j++)
-                vmm_unmap_page((void *)(current_large_heap_addr + j * PMM_BLOCK_SIZE));
-            return NULL;
-        }
-      vmm_map_page_to_curr_dir((void *)vir_addr, addr, PAGE_WRITEABLE);//todo add the right flags
+    if (!kmalloc_large_map(base, num_pages)) {
+        buddy_free_range(&large_heap, first_page, num_pages);
+        return NULL;
     }
+    large_alloc_pages[first_page] = num_pages;
+    return (void *)base;
+}
 
-    void *ptr = (void *)current_large_heap_addr;
-    current_large_heap_addr += aligned_size;
-    insert_large_alloc(create_large_alloc(size, ptr));
-    return ptr;
+// Returns the first page of the large allocation at ptr, or LARGE_NO_ALLOC if ptr is not one
+static size_t large_alloc_first_page(const void *ptr)
+{
+    const uint32_t addr = (uint32_t) ptr;
+    if (addr < KERNEL_LARGE_HEAP_ADDR || addr >= KERNEL_LARGE_HEAP_ADDR + KERNEL_LARGE_HEAP_SIZE)
+        return LARGE_NO_ALLOC;
+    if (addr & (PMM_BLOCK_SIZE - 1))
+        return LARGE_NO_ALLOC; // large allocations start at a page
+    const size_t first_page = (addr - KERNEL_LARGE_HEAP_ADDR) / PMM_BLOCK_SIZE;
+    return large_alloc_pages[first_page] == 0 ? LARGE_NO_ALLOC : first_page;
 }
 
 static bool _kmalloc_large_free(void *ptr)
 {
-    if (ptr == NULL)
+    const size_t first_page = large_alloc_first_page(ptr);
+    if (first_page == LARGE_NO_ALLOC)
         return false;
+    const size_t num_pages = large_alloc_pages[first_page];
+    for (size_t i = 0; i < num_pages; i++)
+        vmm_unmap_page((void *)((uint32_t) ptr + i * PMM_BLOCK_SIZE));
+    large_alloc_pages[first_page] = 0;
+    buddy_free_range(&large_heap, first_page, num_pages);
+    return true;
+}
 
-    large_alloc_t *alloc = get_large_alloc_by_ptr(ptr);
-    if (alloc == NULL)
-        return false;
-    size_t size = alloc->size;
-    size_t aligned_size = (size + PMM_BLOCK_SIZE - 1) & ~(PMM_BLOCK_SIZE - 1);
-    for (size_t i = 0; i < aligned_size / PMM_BLOCK_SIZE; i++) {
-        uint32_t addr = (uint32_t)ptr + i * PMM_BLOCK_SIZE;
-        vmm_unmap_page((void *)addr);
+/*
+ * Grows or shrinks the large allocation without moving it. It can grow only if the pages right after it are free.
+ * return true on success, false if the allocation has to move
+ */
+static bool kmalloc_large_resize(size_t first_page, size_t new_pages)
+{
+    const size_t num_pages = large_alloc_pages[first_page];
+    const uint32_t base = KERNEL_LARGE_HEAP_ADDR + first_page * PMM_BLOCK_SIZE;
+    if (new_pages <= num_pages) {
+        for (size_t i = new_pages; i < num_pages; i++)
+            vmm_unmap_page((void *)(base + i * PMM_BLOCK_SIZE));
+        buddy_free_range(&large_heap, first_page + new_pages, num_pages - new_pages);
+    } else {
+        if (new_pages > LARGE_HEAP_PAGES - first_page)
+            return false;
+        for (size_t i = num_pages; i < new_pages; i++) {
+            if (!buddy_is_free(&large_heap, first_page + i))
+                return false;
+        }
+        buddy_reserve_range(&large_heap, first_page + num_pages, new_pages - num_pages);
+        if (!kmalloc_large_map(base + num_pages * PMM_BLOCK_SIZE, new_pages - num_pages)) {
+            buddy_free_range(&large_heap, first_page + num_pages, new_pages - num_pages);
+            return false;
+        }
     }
-    large_alloc_remove(alloc);
+    large_alloc_pages[first_page] = new_pages;
     return true;
 }
 
+static inline bool is_slab_object(const void *ptr) {
+    return ptr >= (void *)KERNEL_BASE_HEAP_ADDR && ptr < (void *)(KERNEL_BASE_HEAP_ADDR + KERNEL_HEAP_SIZE);
+}
 
-void* kmalloc(size_t size)
+static inline struct slab *slab_of(const void *ptr) {
+    return (struct slab *) ((size_t) ptr & ~(PMM_BLOCK_SIZE - 1));
+}
+
+// ---------------------------- Profiling ----------------------------
+
+#ifdef KMALLOC_PROFILE
+// Finds the entry of the site and size class, a new one if it has none. The table is open addressed
+static uint8_t profile_site_index(uint32_t site, uint32_t size_class) {
+    const uint32_t start = ((site >> 2) * 0x9E3779B1u + size_class) % (KMALLOC_PROFILE_SITES - 1) + 1;
+    uint32_t index = start;
+    do {
+        kmalloc_site_stats_t *entry = &profile_sites[index];
+        if (entry->site == site && entry->size_class == size_class)
+            return index;
+        if (entry->site == 0) {
+            entry->site = site;
+            entry->size_class = size_class;
+            return index;
+        }
+        index = index % (KMALLOC_PROFILE_SITES - 1) + 1;
+    } while (index != start);
+    profile_sites[0].size_class = NUM_CACHES + 1; // the table is full, 0 has the rest of the sites
+    return 0;
+}
+
+// The entry of the tag of the object and the bytes it holds, NULL for objects that are not charged to a site
+static uint8_t *profile_tag_of(const void *ptr, uint32_t *size_class, uint32_t *bytes) {
+    if (is_slab_object(ptr)) {
+        struct slab *slab = slab_of(ptr);
+        if (slab->cache >= &caches[NUM_CACHES])
+            return NULL; // the objects of typed caches are charged to their cache
+        *size_class = slab->cache - caches;
+        *bytes = slab->cache->object_size;
+        return &slab->sites[((uint32_t) ptr - (uint32_t) slab) / KMALLOC_ALIGN];
+    }
+    const size_t first_page = large_alloc_first_page(ptr);
+    if (first_page == LARGE_NO_ALLOC)
+        return NULL;
+    *size_class = NUM_CACHES;
+    *bytes = large_alloc_pages[first_page] * PMM_BLOCK_SIZE;
+    return &large_alloc_sites[first_page];
+}
+
+static void profile_alloc(const void *ptr, uint32_t site) {
+    uint32_t size_class, bytes;
+    uint8_t *tag = ptr != NULL ? profile_tag_of(ptr, &size_class, &bytes) : NULL;
+    if (tag == NULL)
+        return;
+    *tag = profile_site_index(site, size_class);
+    kmalloc_site_stats_t *entry = &profile_sites[*tag];
+    entry->allocations++;
+    entry->live_objects++;
+    entry->live_bytes += bytes;
+}
+
+static void profile_free(const void *ptr) {
+    uint32_t size_class, bytes;
+    const uint8_t *tag = ptr != NULL ? profile_tag_of(ptr, &size_class, &bytes) : NULL;
+    if (tag == NULL)
+        return;
+    kmalloc_site_stats_t *entry = &profile_sites[*tag];
+    entry->live_objects--;
+    entry->live_bytes -= bytes;
+}
+#else
+static inline void profile_alloc(const void *ptr, uint32_t site) {}
+static inline void profile_free(const void *ptr) {}
+#endif
+
+#define CALLER_SITE() ((uint32_t) __builtin_return_address(0))
+
+size_t kmalloc_profile_get_sites(kmalloc_site_stats_t *sites, size_t max_sites) {
+    size_t count = 0;
+#ifdef KMALLOC_PROFILE
+    for (size_t i = 0; i < KMALLOC_PROFILE_SITES && count < max_sites; i++) {
+        if (profile_sites[i].allocations != 0)
+            sites[count++] = profile_sites[i];
+    }
+#endif
+    return count;
+}
+
+void kmalloc_profile_dump() {
+#ifdef KMALLOC_PROFILE
+    printf("kmalloc sites with live memory:\n");
+    serial_puts("kmalloc sites with live memory:\n");
+    for (size_t i = 0; i < KMALLOC_PROFILE_SITES; i++) {
+        const kmalloc_site_stats_t *entry = &profile_sites[i];
+        if (entry->live_objects == 0)
+            continue;
+        const uint32_t class_size = entry->size_class < NUM_CACHES ? caches[entry->size_class].object_size : 0;
+        printf("  site %x class %d: %d live objects, %d bytes (%d allocations)\n", entry->site, class_size,
+               entry->live_objects, entry->live_bytes, entry->allocations);
+        serial_puts("  site ");
+        serial_put_hexa(entry->site);
+        serial_puts(" class ");
+        serial_put_uint(class_size);
+        serial_puts(": ");
+        serial_put_uint(entry->live_objects);
+        serial_puts(" live objects, ");
+        serial_put_uint(entry->live_bytes);
+        serial_puts(" bytes (");
+        serial_put_uint(entry->allocations);
+        serial_puts(" allocations)\n");
+    }
+#else
+    printf("kmalloc profiling is off, build with -DKMALLOC_PROFILE\n");
+#endif
+}
+
+
+static void *kmalloc_unprofiled(size_t size)
 {
     if(size > MAX_CACHE_SIZE) // less likely
-        return kmalloc_large(size);
+        return kmalloc_large(size, PMM_BLOCK_SIZE);
     struct cache* cache = get_cache(size);
-    if(cache == NULL)
-    {
-        panic("Cache for slab was not found, how tf did we get here?");
-    }
+    cache->allocations++;
+    cache->requested_bytes += size;
     return alloc_from_cache(cache);
 }
 
-void kfree(void *ptr) {
+static void kfree_unprofiled(void *ptr) {
     if (ptr == NULL)
         return;
-    if (ptr < (void *)KERNEL_BASE_HEAP_ADDR || ptr > (void *)(KERNEL_BASE_HEAP_ADDR + KERNEL_HEAP_SIZE))
+    if (!is_slab_object(ptr))
          _kmalloc_large_free(ptr);
     else{
-      struct slab *slab = (struct slab *) ((size_t) ptr & ~(PMM_BLOCK_SIZE - 1));
+      struct slab *slab = slab_of(ptr);
       slab_free(slab, ptr);
     }
 }
 
+void* kmalloc(size_t size)
+{
+    void *ptr = kmalloc_unprofiled(size);
+    profile_alloc(ptr, CALLER_SITE());
+    return ptr;
+}
+
+void kfree(void *ptr) {
+    profile_free(ptr);
+    kfree_unprofiled(ptr);
+}
+
+void *kmalloc_aligned(size_t size, size_t align)
+{
+    assert(align != 0 && (align & (align - 1)) == 0);
+    // The objects of the size classes are KMALLOC_ALIGN aligned, anything stricter takes whole pages
+    void *ptr = align <= KMALLOC_ALIGN ? kmalloc_unprofiled(size) : kmalloc_large(size, align);
+    profile_alloc(ptr, CALLER_SITE());
+    return ptr;
+}
+
+// krealloc without the profiling, see krealloc
+static void *krealloc_unprofiled(void *ptr, size_t size)
+{
+
+    size_t old_size;
+    if (is_slab_object(ptr)) {
+        old_size = slab_of(ptr)->cache->object_size;
+        if (size <= old_size)
+            return ptr; // it still fits in its object
+    } else {
+        const size_t first_page = large_alloc_first_page(ptr);
+        if (first_page == LARGE_NO_ALLOC)
+            panic("krealloc of memory that kmalloc never gave, nice try");
+        if (kmalloc_large_resize(first_page, size_to_pages(size)))
+            return ptr;
+        old_size = large_alloc_pages[first_page] * PMM_BLOCK_SIZE;
+    }
+
+    void *new_ptr = kmalloc_unprofiled(size);
+    if (new_ptr == NULL)
+        return NULL; // the old memory is left as it was
+    memcpy(new_ptr, ptr, old_size < size ? old_size : size);
+    kfree_unprofiled(ptr);
+    return new_ptr;
+}
+
+void *krealloc(void *ptr, size_t size)
+{
+    if (size == 0) {
+        kfree(ptr);
+        return NULL;
+    }
+    if (ptr == NULL) {
+        ptr = kmalloc_unprofiled(size);
+        profile_alloc(ptr, CALLER_SITE());
+        return ptr;
+    }
+    // The memory is charged again after the resize, it may have moved or changed its size
+    profile_free(ptr);
+    void *new_ptr = krealloc_unprofiled(ptr, size);
+    profile_alloc(new_ptr != NULL ? new_ptr : ptr, CALLER_SITE());
+    return new_ptr;
+}
+
+kmem_cache_t *kmem_cache_create(const char *name, size_t size, size_t align, kmem_ctor_t ctor) {
+    if (align == 0)
+        align = sizeof(void *);
+    assert((align & (align - 1)) == 0);
+    if (size == 0 || caches_count == NUM_CACHES + KMEM_MAX_CACHES)
+        return NULL;
+
+    struct cache *cache = &caches[caches_count];
+    cache->name = name;
+    cache->object_size = size;
+    cache->align = align;
+    cache->ctor = ctor;
+    // A constructed object keeps its state while it is free, so its free list link goes after it
+    cache->link_offset = ctor != NULL ? ALIGN_UP(size, sizeof(void *)) : 0;
+    const size_t stride = ctor != NULL ? cache->link_offset + sizeof(void *) : size;
+    cache->stride = ALIGN_UP(stride < sizeof(void *) ? sizeof(void *) : stride, align);
+    if (slab_first_object_offset(cache) + cache->stride > PMM_BLOCK_SIZE)
+        return NULL; // not even one object fits in a slab
+    caches_count++;
+    return cache;
+}
+
+void *kmem_cache_alloc(kmem_cache_t *cache) {
+    assert(cache != NULL);
+    return alloc_from_cache(cache);
+}
+
+void kmem_cache_free(kmem_cache_t *cache, void *object) {
+    if (object == NULL)
+        return;
+    struct slab *slab = slab_of(object);
+    assert(slab->cache == cache); // freed to the wrong cache
+    slab_free(slab, object);
+}
 
 void init_kmalloc() {
-    // The heap is already mapped in the vmm_init function
-    current_heap_addr = KERNEL_BASE_HEAP_ADDR;
-    current_large_heap_addr = KERNEL_BASE_HEAP_ADDR + KERNEL_HEAP_SIZE;
+    // The page tables of the heap are created in the vmm_init function, the slabs are mapped on demand
+    summary_bitmap_init(&free_heap_slots, HEAP_SLOTS, free_heap_slots_storage);
+    for (size_t slot = 0; slot < HEAP_SLOTS; slot++)
+        summary_bitmap_set(&free_heap_slots, slot);
+    buddy_init(&large_heap, LARGE_HEAP_PAGES, large_heap_metadata);
+    buddy_free_range(&large_heap, 0, LARGE_HEAP_PAGES);
+    init_size_class_index();
     for (size_t i = 0; i < NUM_CACHES; i++) {
-        caches[i].slabs = create_slab(caches[i].object_size);
-        if (caches[i].slabs == NULL) {
+        if (create_slab(&caches[i]) == NULL) {
             panic("Failed to allocate memory for kmalloc, what piece of shit computer do you have?\n"
                   "Its probably my fault :)");
         }
     }
+    pmm_register_shrinker(kmalloc_shrink);
+}
+
+kmalloc_cache_stats_t kmalloc_get_cache_stats(size_t cache_index) {
+    assert(cache_index < NUM_CACHES);
+    return kmem_cache_get_stats(&caches[cache_index]);
+}
+
+kmalloc_cache_stats_t kmem_cache_get_stats(const kmem_cache_t *cache) {
+    const kmalloc_cache_stats_t stats = {
+        .object_size = cache->object_size,
+        .partial_slabs = cache->slabs_count[SLAB_PARTIAL],
+        .full_slabs = cache->slabs_count[SLAB_FULL],
+        .empty_slabs = cache->slabs_count[SLAB_EMPTY],
+        .allocations = cache->allocations,
+        .requested_bytes = cache->requested_bytes,
+        .wasted_bytes = (uint64_t) cache->allocations * cache->object_size - cache->requested_bytes,
+    };
+    return stats;
 }
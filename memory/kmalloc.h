@@ -14,12 +14,90 @@
 void init_kmalloc(); // When loading the kernel the function allocated the necessary stuff for the kmalloc
 void *kmalloc(size_t size);
 void kfree(void *ptr);
+/*
+ * Allocates memory aligned to align, a power of two. Alignments above KMALLOC_ALIGN take whole pages,
+ * for many small aligned objects use a cache with an alignment (kmem_cache_create) instead.
+ */
+void *kmalloc_aligned(size_t size, size_t align);
+/*
+ * Resizes the memory in place when its slab object is big enough or the pages after its large allocation are
+ * free, otherwise moves it. Memory that moved is only KMALLOC_ALIGN aligned.
+ * return the memory or NULL if there is no memory, the old memory is left as it was then
+ */
+void *krealloc(void *ptr, size_t size);
 
-extern uint32_t KERNEL_BASE_HEAP_ADDR;
-#define NUM_CACHES 8u
+#define NUM_CACHES 24u // 16 bytes steps up to 128, then four classes for every power of two up to 2048
 #define MAX_CACHE_SIZE 2048u
-#define EXTRA_BLOCKS  100u // extra blocks the kmalloc can use
-#define KERNEL_HEAP_SIZE (PMM_BLOCK_SIZE * (NUM_CACHES + EXTRA_BLOCKS))
+#define KMALLOC_ALIGN 16u // the granularity of the size class lookup
+#define KMALLOC_CACHE_LINE 64u // slabs are colored in steps of a cache line
+// The slab heap is a reserved kernel virtual range, its pages are mapped to frames from the pmm as it grows
+#define KERNEL_BASE_HEAP_ADDR 0xD0000000u
+#ifndef KERNEL_HEAP_SIZE
+#define KERNEL_HEAP_SIZE 0x1000000u // 16MB - the ceiling of the slab heap, every 4MB of it costs a page table
+#endif
+// The allocations above MAX_CACHE_SIZE are mapped to their own window, right after the slab heap
+#define KERNEL_LARGE_HEAP_ADDR (KERNEL_BASE_HEAP_ADDR + KERNEL_HEAP_SIZE)
+#ifndef KERNEL_LARGE_HEAP_SIZE
+#define KERNEL_LARGE_HEAP_SIZE 0x2000000u // 32MB
+#endif
+#define KMEM_MAX_CACHES 16u // caches that can be made with kmem_cache_create
+#define KMALLOC_EMPTY_SLABS_RESERVE 1u // empty slabs every cache keeps when the pmm shrinks it
+
+typedef enum {
+    SLAB_PARTIAL, // Some of the objects are free
+    SLAB_FULL,    // None of the objects is free
+    SLAB_EMPTY,   // All of the objects are free
+    SLAB_STATES
+} slab_state_t;
+
+typedef struct {
+    size_t object_size;
+    size_t partial_slabs;
+    size_t full_slabs;
+    size_t empty_slabs;
+    size_t allocations;       // kmalloc calls the cache served
+    uint64_t requested_bytes; // bytes those calls asked for
+    uint64_t wasted_bytes;    // internal fragmentation - bytes they got on top of what they asked for
+} kmalloc_cache_stats_t;
+
+typedef struct cache kmem_cache_t;
+typedef void (*kmem_ctor_t)(void *object);
+
+/*
+ * Creates a cache of objects of a single type, its objects are packed by their size instead of a size class.
+ * @param name the name of the cache, kept by pointer
+ * @param align the alignment of the objects (a power of two), 0 for pointer alignment
+ * @param ctor called once on every object when its slab is created, NULL for none. An object with a
+ *             constructor must be freed in its constructed state, so allocating it doesn't initialize it again
+ * @return the cache or NULL if there are too many caches or an object doesn't fit in a slab
+ */
+kmem_cache_t *kmem_cache_create(const char *name, size_t size, size_t align, kmem_ctor_t ctor);
+void *kmem_cache_alloc(kmem_cache_t *cache);
+// The object can be freed with kfree too
+void kmem_cache_free(kmem_cache_t *cache, void *object);
+
+// Counters of the cache of the cache_index-th size class, cache_index < NUM_CACHES
+kmalloc_cache_stats_t kmalloc_get_cache_stats(size_t cache_index);
+kmalloc_cache_stats_t kmem_cache_get_stats(const kmem_cache_t *cache);
+
+#define KMALLOC_PROFILE_SITES 256u // entries of the call sites table of KMALLOC_PROFILE
+
+// The memory a call site of kmalloc holds in one size class, recorded when built with KMALLOC_PROFILE
+typedef struct {
+    uint32_t site;         // Return address of the call to kmalloc, kmalloc_aligned or krealloc. 0 for the rest
+    uint32_t size_class;   // Index of the size class, NUM_CACHES for the large heap
+    uint32_t allocations;  // Allocations the site made
+    uint32_t live_objects; // Allocations the site made that were not freed yet
+    uint32_t live_bytes;   // Bytes those allocations hold, by the size of their class
+} kmalloc_site_stats_t;
+
+/*
+ * Copies the entries of the call sites that made allocations.
+ * return the amount of entries copied, always 0 without KMALLOC_PROFILE
+ */
+size_t kmalloc_profile_get_sites(kmalloc_site_stats_t *sites, size_t max_sites);
+// Prints the sites that hold memory to the screen and to the serial port
+void kmalloc_profile_dump();
 
 
 #endif //MYKERNELPROJECT_KMALLOC_H
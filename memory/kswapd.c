@@ -0,0 +1,63 @@
+//
+// Created by Yoav on 10/18/2026.
+//
+
+#include "kswapd.h"
+#include "pmm.h"
+#include "vmm.h"
+#include "../std/stdio.h"
+
+static bool awake = false;
+static kswapd_stats_t stats = {0};
+
+// return the amount of frames the normal zone is missing to get above its high watermark, 0 if it is above
+static size_t frames_below_high() {
+    const pmm_zone_stats_t zone = pmm_get_zone_stats(ZONE_NORMAL);
+    const size_t free_frames = zone.free_frames + zone.cached_frames;
+    return free_frames < zone.watermark_high ? zone.watermark_high - free_frames : 0;
+}
+
+void kswapd_wake() {
+    if (awake)
+        return;
+    awake = true;
+    stats.wakeups++;
+}
+
+size_t kswapd_run(size_t budget) {
+    if (!awake)
+        return 0;
+
+    size_t reclaimed = 0;
+    size_t missing = frames_below_high();
+    for (size_t round = 0; round < budget && missing > 0; round++) {
+        // The shrinkers (e.g. the empty slabs of kmalloc) are cheaper than the disk, so they go first
+        size_t freed = pmm_shrink(missing);
+        if (freed == 0)
+            freed = vmm_swap_out_cluster(VMM_SWAP_CLUSTER_PAGES);
+        if (freed == 0) {
+            missing = 0; // nothing left to reclaim, sleep until the next wake up
+            break;
+        }
+        reclaimed += freed;
+        missing = frames_below_high();
+    }
+    if (missing == 0)
+        awake = false;
+    stats.frames_reclaimed += reclaimed;
+    return reclaimed;
+}
+
+void kswapd_count_direct_reclaim() {
+    stats.direct_reclaims++;
+}
+
+kswapd_stats_t kswapd_get_stats() {
+    return stats;
+}
+
+void kswapd_dump() {
+    printf("kswapd is %s: %d wake ups, %d frames reclaimed, %d direct reclaims\n", awake ? "awake" : "asleep",
+           stats.wakeups, stats.frames_reclaimed, stats.direct_reclaims);
+    printf("  it only runs while the shell waits for input, a running command reclaims by itself\n");
+}
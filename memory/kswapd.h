@@ -0,0 +1,47 @@
+//
+// Created by Yoav on 10/18/2026.
+//
+
+/*
+ * Background reclaim, named after its Linux counterpart.
+ * When an allocation leaves the normal zone below its low watermark, kswapd is woken. It reclaims - the
+ * shrinkers first, then swap clusters - until the zone is back above its high watermark, so the faulting
+ * code doesn't wait for the disk. The allocation paths only reclaim by themselves (direct reclaim) when there
+ * is no free frame at all.
+ * There is no scheduler running yet, so kswapd is not a thread. It runs in the only idle time the kernel has -
+ * kernel_idle, while the shell waits for a key - before frame zeroing. While the shell runs a command
+ * background reclaim stalls, and the allocations of the command fall back to direct reclaim.
+ */
+
+#ifndef MYKERNEL_KSWAPD_H
+#define MYKERNEL_KSWAPD_H
+
+#include "../std/stdint.h"
+#include "../std/stdbool.h"
+
+#define KSWAPD_IDLE_BUDGET 1u // Reclaim rounds (a shrink or a swap cluster) per call from kernel_idle
+
+typedef struct {
+    size_t wakeups;          // Times kswapd was woken while it was asleep
+    size_t frames_reclaimed; // Frames reclaimed in the background
+    size_t direct_reclaims;  // Times an allocation had to reclaim by itself, kswapd didn't keep up
+} kswapd_stats_t;
+
+// Asks for background reclaim, cheap enough to call on every allocation that sees the zone low
+void kswapd_wake();
+
+/*
+ * Reclaims up to budget rounds if kswapd is awake, and goes to sleep once the zone is above its high
+ * watermark or there is nothing left to reclaim.
+ * return the amount of frames reclaimed
+ */
+size_t kswapd_run(size_t budget);
+
+// Counts a direct reclaim, called by the allocation paths
+void kswapd_count_direct_reclaim();
+
+kswapd_stats_t kswapd_get_stats();
+// Prints the stats to the screen
+void kswapd_dump();
+
+#endif //MYKERNEL_KSWAPD_H
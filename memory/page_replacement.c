@@ -0,0 +1,307 @@
+//
+// Created by Yoav on 10/18/2026.
+//
+
+#include "page_replacement.h"
+#include "vmm.h"
+#include "../std/assert.h"
+#include "../std/string.h"
+#include "../std/stdio.h"
+
+// A circular list of frames linked through their descriptors, the head is the next frame to look at
+typedef struct {
+    uint32_t head; // Frame number of the first frame, PMM_FRAME_NO_LINK if the list is empty
+    size_t count;
+} frame_list_t;
+
+static uint32_t virtual_time = 0; // Page faults so far, the time of the working set
+static size_t tracked_pages = 0;
+
+// ---------------------------- Helper functions ----------------------------
+
+static inline physical_addr frame_number_addr(uint32_t frame_number) {
+    return (physical_addr) frame_number * PMM_BLOCK_SIZE;
+}
+
+static inline uint32_t frame_number_of(physical_addr frame_addr) {
+    return frame_addr / PMM_BLOCK_SIZE;
+}
+
+static inline pmm_frame_t *frame_of_number(uint32_t frame_number) {
+    return pmm_frame_of(frame_number_addr(frame_number));
+}
+
+static inline void *page_of_number(uint32_t frame_number) {
+    return (void *) frame_of_number(frame_number)->vir_addr;
+}
+
+// Adds the frame at the tail of the list, right behind the head
+static void list_add_tail(frame_list_t *list, uint32_t frame_number) {
+    pmm_frame_t *frame = frame_of_number(frame_number);
+    if (list->head == PMM_FRAME_NO_LINK) {
+        frame->lru_prev = frame->lru_next = frame_number;
+        list->head = frame_number;
+    } else {
+        pmm_frame_t *head = frame_of_number(list->head);
+        frame->lru_next = list->head;
+        frame->lru_prev = head->lru_prev;
+        frame_of_number(head->lru_prev)->lru_next = frame_number;
+        head->lru_prev = frame_number;
+    }
+    list->count++;
+}
+
+static void list_remove(frame_list_t *list, uint32_t frame_number) {
+    pmm_frame_t *frame = frame_of_number(frame_number);
+    assert(list->count > 0);
+    if (frame->lru_next == frame_number) // the last frame in the list
+        list->head = PMM_FRAME_NO_LINK;
+    else {
+        frame_of_number(frame->lru_prev)->lru_next = frame->lru_next;
+        frame_of_number(frame->lru_next)->lru_prev = frame->lru_prev;
+        if (list->head == frame_number)
+            list->head = frame->lru_next;
+    }
+    frame->lru_prev = frame->lru_next = PMM_FRAME_NO_LINK;
+    list->count--;
+}
+
+// The head goes to the tail, like the hand of a clock that moves to the next frame
+static inline void list_rotate(frame_list_t *list) {
+    list->head = frame_of_number(list->head)->lru_next;
+}
+
+/*
+ * Goes over the list from its head and returns the first page that can be evicted. With second_chance a page
+ * that was accessed is skipped once (the clock algorithm), without it the order of the list is all that counts.
+ * The frames that were looked at go to the tail.
+ * return the frame number or PMM_FRAME_NO_LINK if there is no such page
+ */
+static uint32_t list_find_victim(frame_list_t *list, bool second_chance) {
+    // Two rounds are enough for the second chance, the first one clears every accessed bit
+    for (size_t steps = second_chance ? 2 * list->count : list->count; steps > 0; steps--) {
+        const uint32_t frame_number = list->head;
+        list_rotate(list);
+        const page_access_t access = vmm_page_test_and_clear_accessed(frame_number_addr(frame_number));
+        if (access == PAGE_IDLE || (access == PAGE_ACCESSED && !second_chance))
+            return frame_number;
+    }
+    return PMM_FRAME_NO_LINK;
+}
+
+// ---------------------------- FIFO, Clock and WSClock ----------------------------
+// They keep the resident pages in a single list in the order they came in
+
+static frame_list_t resident = {PMM_FRAME_NO_LINK, 0};
+
+static void resident_page_in(physical_addr frame_addr, void *vir_addr, bool swapped_in) {
+    list_add_tail(&resident, frame_number_of(frame_addr));
+}
+
+static void resident_page_out(physical_addr frame_addr) {
+    list_remove(&resident, frame_number_of(frame_addr));
+}
+
+static void *fifo_choose_victim() {
+    const uint32_t victim = list_find_victim(&resident, false);
+    return victim == PMM_FRAME_NO_LINK ? NULL : page_of_number(victim);
+}
+
+static void *clock_choose_victim() {
+    const uint32_t victim = list_find_victim(&resident, true);
+    return victim == PMM_FRAME_NO_LINK ? NULL : page_of_number(victim);
+}
+
+// Notes when the pages were last accessed, so their age is known when the hand gets to them
+static void wsclock_sample() {
+    uint32_t frame_number = resident.head;
+    for (size_t i = 0; i < resident.count; i++) {
+        pmm_frame_t *frame = frame_of_number(frame_number);
+        if (vmm_page_test_and_clear_accessed(frame_number_addr(frame_number)) == PAGE_ACCESSED)
+            frame->last_use = virtual_time;
+        frame_number = frame->lru_next;
+    }
+}
+
+/*
+ * The hand takes the first idle page that is out of the working set - not accessed in the last
+ * PAGE_REPLACEMENT_WS_WINDOW faults. If every page is in the working set the oldest idle page goes.
+ */
+static void *wsclock_choose_victim() {
+    uint32_t oldest = PMM_FRAME_NO_LINK;
+    for (size_t steps = resident.count; steps > 0; steps--) {
+        const uint32_t frame_number = resident.head;
+        pmm_frame_t *frame = frame_of_number(frame_number);
+        list_rotate(&resident);
+        const page_access_t access = vmm_page_test_and_clear_accessed(frame_number_addr(frame_number));
+        if (access == PAGE_ACCESSED)
+            frame->last_use = virtual_time;
+        if (access != PAGE_IDLE)
+            continue;
+        if (virtual_time - frame->last_use > PAGE_REPLACEMENT_WS_WINDOW)
+            return (void *) frame->vir_addr;
+        if (oldest == PMM_FRAME_NO_LINK || frame->last_use < frame_of_number(oldest)->last_use)
+            oldest = frame_number;
+    }
+    return oldest == PMM_FRAME_NO_LINK ? NULL : page_of_number(oldest);
+}
+
+// ---------------------------- 2Q ----------------------------
+// New pages go to a probation queue (A1in) and are evicted from it in FIFO order, so a burst of accesses to
+// pages that are never used again doesn't flush the pages that are. A page that is faulted back soon after
+// it was evicted from probation (it's in A1out, the ghosts) goes to the main queue (Am), kept in LRU order.
+
+static frame_list_t two_q_in = {PMM_FRAME_NO_LINK, 0};
+static frame_list_t two_q_main = {PMM_FRAME_NO_LINK, 0};
+static uint32_t two_q_ghosts[PAGE_REPLACEMENT_2Q_GHOSTS]; // Pages evicted from probation, 0 if the entry is empty
+static size_t two_q_next_ghost = 0;
+
+static bool two_q_take_ghost(uint32_t vir_addr) {
+    for (size_t i = 0; i < PAGE_REPLACEMENT_2Q_GHOSTS; i++) {
+        if (two_q_ghosts[i] == vir_addr) {
+            two_q_ghosts[i] = 0;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void two_q_add_ghost(uint32_t vir_addr) {
+    two_q_ghosts[two_q_next_ghost] = vir_addr;
+    two_q_next_ghost = (two_q_next_ghost + 1) % PAGE_REPLACEMENT_2Q_GHOSTS;
+}
+
+static void two_q_page_in(physical_addr frame_addr, void *vir_addr, bool swapped_in) {
+    pmm_frame_t *frame = pmm_frame_of(frame_addr);
+    if (swapped_in && two_q_take_ghost((uint32_t) vir_addr)) {
+        frame->flags |= PMM_FRAME_ACTIVE;
+        list_add_tail(&two_q_main, frame_number_of(frame_addr));
+    } else
+        list_add_tail(&two_q_in, frame_number_of(frame_addr));
+}
+
+static void two_q_page_out(physical_addr frame_addr) {
+    pmm_frame_t *frame = pmm_frame_of(frame_addr);
+    list_remove(frame->flags & PMM_FRAME_ACTIVE ? &two_q_main : &two_q_in, frame_number_of(frame_addr));
+    frame->flags &= ~PMM_FRAME_ACTIVE;
+}
+
+// Keeps the main queue in LRU order, the pages that were accessed move to its tail
+static void two_q_sample() {
+    uint32_t frame_number = two_q_main.head;
+    for (size_t i = two_q_main.count; i > 0; i--) {
+        const uint32_t next = frame_of_number(frame_number)->lru_next;
+        if (vmm_page_test_and_clear_accessed(frame_number_addr(frame_number)) == PAGE_ACCESSED) {
+            list_remove(&two_q_main, frame_number);
+            list_add_tail(&two_q_main, frame_number);
+        }
+        frame_number = next;
+    }
+}
+
+static void *two_q_choose_victim() {
+    // Probation goes first as long as it holds more than its share of the pages
+    uint32_t victim = PMM_FRAME_NO_LINK;
+    if (two_q_in.count * PAGE_REPLACEMENT_2Q_IN_SHARE > two_q_in.count + two_q_main.count)
+        victim = list_find_victim(&two_q_in, false);
+    if (victim == PMM_FRAME_NO_LINK)
+        victim = list_find_victim(&two_q_main, true);
+    if (victim == PMM_FRAME_NO_LINK)
+        victim = list_find_victim(&two_q_in, false);
+    return victim == PMM_FRAME_NO_LINK ? NULL : page_of_number(victim);
+}
+
+// A page is a ghost only once it's on the disk, a victim that failed to be written is still resident
+static void two_q_evicted(physical_addr frame_addr) {
+    const pmm_frame_t *frame = pmm_frame_of(frame_addr);
+    if (!(frame->flags & PMM_FRAME_ACTIVE))
+        two_q_add_ghost(frame->vir_addr);
+}
+
+// ---------------------------- Page replacement functions ----------------------------
+
+static page_replacement_policy_t policies[] = {
+    {"clock", resident_page_in, resident_page_out, NULL, clock_choose_victim, NULL, {0}},
+    {"fifo", resident_page_in, resident_page_out, NULL, fifo_choose_victim, NULL, {0}},
+    {"2q", two_q_page_in, two_q_page_out, two_q_sample, two_q_choose_victim, two_q_evicted, {0}},
+    {"wsclock", resident_page_in, resident_page_out, wsclock_sample, wsclock_choose_victim, NULL, {0}},
+};
+#define POLICIES_COUNT (sizeof(policies) / sizeof(policies[0]))
+
+static page_replacement_policy_t *current_policy = &policies[0];
+
+bool page_replacement_select(const char *name) {
+    if (tracked_pages != 0)
+        return false; // the pages are in the lists of the current policy
+    for (size_t i = 0; i < POLICIES_COUNT; i++) {
+        if (!strcmp(policies[i].name, name)) {
+            current_policy = &policies[i];
+            return true;
+        }
+    }
+    return false;
+}
+
+const page_replacement_policy_t *page_replacement_current() {
+    return current_policy;
+}
+
+const page_replacement_policy_t *page_replacement_get_policies(size_t *count) {
+    *count = POLICIES_COUNT;
+    return policies;
+}
+
+void page_replacement_dump() {
+    printf("page replacement, %s is active:\n", current_policy->name);
+    for (size_t i = 0; i < POLICIES_COUNT; i++) {
+        const page_replacement_stats_t *stats = &policies[i].stats;
+        printf("  %s: %d faults, %d swap ins, %d page ins, %d evictions\n", policies[i].name, stats->faults,
+               stats->swap_ins, stats->page_ins, stats->evictions);
+    }
+}
+
+void page_replacement_page_in(physical_addr frame_addr, void *vir_addr, bool swapped_in) {
+    pmm_frame_t *frame = pmm_frame_of(frame_addr);
+    if (frame == NULL || page_replacement_is_tracked(frame_addr))
+        return;
+    // A demand zero fault hands over the faulting address, the policies (and the 2Q ghosts) work with pages
+    vir_addr = (void *) ((uint32_t) vir_addr & ~(PAGE_SIZE - 1));
+    frame->vir_addr = (uint32_t) vir_addr;
+    frame->last_use = virtual_time;
+    current_policy->page_in(frame_addr, vir_addr, swapped_in);
+    tracked_pages++;
+    current_policy->stats.page_ins++;
+    if (swapped_in)
+        current_policy->stats.swap_ins++;
+}
+
+void page_replacement_page_out(physical_addr frame_addr) {
+    if (!page_replacement_is_tracked(frame_addr))
+        return;
+    current_policy->page_out(frame_addr);
+    tracked_pages--;
+}
+
+void page_replacement_fault() {
+    virtual_time++;
+    current_policy->stats.faults++;
+    if (current_policy->sample != NULL && virtual_time % PAGE_REPLACEMENT_SAMPLE_INTERVAL == 0)
+        current_policy->sample();
+}
+
+void *page_replacement_choose_victim() {
+    return current_policy->choose_victim();
+}
+
+void page_replacement_evicted(physical_addr frame_addr) {
+    if (!page_replacement_is_tracked(frame_addr))
+        return;
+    current_policy->stats.evictions++;
+    if (current_policy->evicted != NULL)
+        current_policy->evicted(frame_addr);
+}
+
+bool page_replacement_is_tracked(physical_addr frame_addr) {
+    const pmm_frame_t *frame = pmm_frame_of(frame_addr);
+    return frame != NULL && frame->lru_next != PMM_FRAME_NO_LINK;
+}
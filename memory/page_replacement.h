@@ -0,0 +1,74 @@
+//
+// Created by Yoav on 10/18/2026.
+//
+
+/*
+ * Page replacement policies - which resident page the VMM swaps out when it needs a frame.
+ * A policy is a set of hooks the VMM calls: a page became resident, a page stopped being resident, the
+ * accessed bits are sampled and a victim has to be chosen. The pages a policy tracks are linked through
+ * their frame descriptors (lru_prev/lru_next), so tracking a page costs no memory.
+ * The policy is picked at boot and every policy counts the faults it caused while it was active, so the
+ * policies can be compared on the same workload.
+ */
+
+#ifndef MYKERNEL_PAGE_REPLACEMENT_H
+#define MYKERNEL_PAGE_REPLACEMENT_H
+
+#include "../std/stdint.h"
+#include "../std/stdbool.h"
+#include "pmm.h"
+
+#define PAGE_REPLACEMENT_SAMPLE_INTERVAL 64u // The accessed bits are sampled every that many page faults
+#define PAGE_REPLACEMENT_2Q_IN_SHARE 4u     // 2Q keeps 1/4 of its pages in the probation (A1in) queue
+#define PAGE_REPLACEMENT_2Q_GHOSTS 64u      // Pages 2Q remembers after evicting them from probation (A1out)
+#define PAGE_REPLACEMENT_WS_WINDOW 256u     // Working set window of WSClock, in page faults
+
+typedef struct {
+    size_t faults;    // Page faults while the policy was active
+    size_t swap_ins;  // Pages read back from the disk, by a fault or ahead of one - the cost of a bad choice
+    size_t page_ins;  // Pages that became resident
+    size_t evictions; // Pages that were swapped out while the policy was active
+} page_replacement_stats_t;
+
+typedef struct {
+    const char *name;
+    // The page became resident in the frame, swapped_in if it came back from the disk
+    void (*page_in)(physical_addr frame_addr, void *vir_addr, bool swapped_in);
+    // The frame stops being a resident page, it's freed or its page is swapped out
+    void (*page_out)(physical_addr frame_addr);
+    // Reads (and clears) the accessed bits of the pages, NULL if the policy only looks at them on eviction
+    void (*sample)();
+    // Returns the page to swap out, NULL if there is none
+    void *(*choose_victim)();
+    // The page in the frame was written to the disk, called before page_out. NULL if the policy doesn't care
+    void (*evicted)(physical_addr frame_addr);
+    page_replacement_stats_t stats;
+} page_replacement_policy_t;
+
+/*
+ * Selects the policy by name ("fifo", "clock", "2q", "wsclock"), only before the first page is tracked.
+ * return true if the policy exists and was selected
+ */
+bool page_replacement_select(const char *name);
+const page_replacement_policy_t *page_replacement_current();
+/*
+ * Returns the policies to compare their stats.
+ * @param count filled with the amount of policies
+ */
+const page_replacement_policy_t *page_replacement_get_policies(size_t *count);
+// Prints the stats of every policy to the screen
+void page_replacement_dump();
+
+// ---------------------------- Hooks for the VMM ----------------------------
+
+// vir_addr may point anywhere in the page, the page itself is tracked
+void page_replacement_page_in(physical_addr frame_addr, void *vir_addr, bool swapped_in);
+void page_replacement_page_out(physical_addr frame_addr);
+// Counts a page fault, and samples the accessed bits every PAGE_REPLACEMENT_SAMPLE_INTERVAL faults
+void page_replacement_fault();
+void *page_replacement_choose_victim();
+// The page in the frame was swapped out, a victim may not be if writing it failed
+void page_replacement_evicted(physical_addr frame_addr);
+bool page_replacement_is_tracked(physical_addr frame_addr);
+
+#endif //MYKERNEL_PAGE_REPLACEMENT_H
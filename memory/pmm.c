@@ -2,141 +2,595 @@
 // Created by Yoav on 11/29/2024.
 //
 
+/*
+ * The physical memory manager hands out frames using a buddy allocator (see buddy.h),
+ * so it can give physically contiguous runs of frames in O(log n).
+ * The frames are split into zones, each with its own buddy allocator: ZONE_DMA is the memory below 16MB that ISA
+ * DMA can reach and ZONE_NORMAL is the rest. Normal allocations fall back to ZONE_DMA only while it stays
+ * above its min watermark, so DMA capable memory is there when a driver needs it.
+ * Single frames go through a small LIFO cache of recently freed frames in front of the buddy allocator,
+ * so the hot path (page faults, page tables, process teardown) is O(1) and reuses cache-warm frames.
+ * The cache is refilled and drained in batches.
+ * Next to it there is a pool of frames that were zeroed while the kernel was idle, for the callers that need
+ * zeroed memory (page tables, demand zero pages, process stacks).
+ * Every frame also has a descriptor (pmm_frame_t) with its reference count, so frames can be shared.
+ * When PMM_DEBUG is defined a plain bitmap of the used frames is kept next to it and every
+ * allocation and free is cross-checked against it.
+ * The size of everything comes from the bootloader memory map, the metadata is carved at boot from the
+ * memory right after the kernel image.
+ */
+
 #include <stdbool.h>
 #include "../std/assert.h"
 #include "pmm.h"
-#include "kmalloc.h"
-#include "../drivers/screen.h"
+#include "vmm.h"
+#include "../errors.h"
+#include "../std/stdio.h"
+
+typedef struct {
+    uint64_t start;
+    uint64_t end;
+} memory_region_t;
+
+// The usable regions of the bootloader memory map, copied because the metadata may be placed on top of it
+static memory_region_t usable_regions[PMM_MAX_MEMORY_REGIONS];
+static size_t usable_regions_count = 0;
+
+typedef struct {
+    size_t first_frame; // The zone is [first_frame, first_frame + buddy.units)
+    buddy_t buddy;
+    size_t watermark_min;
+    size_t watermark_low;
+    size_t watermark_high;
+} zone_t;
+
+static size_t total_frames = 0;
+static zone_t zones[PMM_ZONES_COUNT];
+static pmm_frame_t *frames = NULL; // Descriptor of every frame, indexed by the frame number
+
+// LIFO cache of free single frames, the frames on it are used as far as the buddy allocator knows
+static physical_addr frame_cache[PMM_FRAME_CACHE_SIZE];
+static size_t frame_cache_count = 0;
+static pmm_frame_cache_stats_t frame_cache_stats = {0};
+
+// Frames that are already zeroed, they are free as far as everyone except pmm_alloc_zeroed_frame knows
+static physical_addr zeroed_pool[PMM_ZEROED_POOL_SIZE];
+static size_t zeroed_pool_count = 0;
+
+// Bump allocator for the metadata, right after the kernel image
+static physical_addr kernel_reserved_end = 0;
 
-// Bitmap for tracking used and free frames
-static uint8_t pmm_bitmap[PMM_BITMAP_SIZE] = {0};
+// Helper Functions
+static inline size_t get_frame_index(physical_addr frame_addr) {
+    return frame_addr / PMM_BLOCK_SIZE;
+}
+
+static inline physical_addr calc_frame_addr(size_t frame_index) {
+    return frame_index * PMM_BLOCK_SIZE;
+}
 
-// Track the last freed frame
-static struct {
-    int32_t index;
-    int8_t offset;
-} last_free_frame = {-1, -1};
+static inline bool is_valid_frame_addr(physical_addr frame_addr) {
+    return get_frame_index(frame_addr) < total_frames && (frame_addr % PMM_BLOCK_SIZE == 0); // Frame address is aligned
+}
 
-// Track the last allocated index for next-fit strategy
-static size_t last_alloc_index = 1;
+#ifdef PMM_DEBUG
+// Bitmap for cross-checking the buddy allocator
+static uint8_t *pmm_bitmap = NULL;
 
 // Macros for bitmap operations
 #define BIT_MASK(offset) (1 << (offset))
 
-// Helper Functions
-static inline size_t calc_frame_addr(size_t index, size_t offset) {
-    return index * 8 * PMM_BLOCK_SIZE + offset * PMM_BLOCK_SIZE;
+static inline size_t get_bitmap_index(size_t frame_index) {
+    return frame_index / 8;
 }
 
-static inline size_t get_bitmap_index(physical_addr frame_addr) {
-    return frame_addr / PMM_BLOCK_SIZE / 8;
+static inline size_t get_bitmap_offset(size_t frame_index) {
+    return frame_index % 8;
 }
 
-static inline size_t get_bitmap_offset(physical_addr frame_addr) {
-    return frame_addr / PMM_BLOCK_SIZE % 8;
+static inline bool pmm_debug_is_used(size_t frame_index) {
+    return pmm_bitmap[get_bitmap_index(frame_index)] & BIT_MASK(get_bitmap_offset(frame_index));
 }
 
-static inline bool is_valid_frame_addr(physical_addr frame_addr) {
-    return frame_addr < MEMORY_SIZE && (frame_addr % PMM_BLOCK_SIZE == 0); // Frame address is aligned
+static void pmm_debug_mark_used(size_t frame_index, size_t count, bool check) {
+    for (size_t i = frame_index; i < frame_index + count; i++) {
+        assert(!check || !pmm_debug_is_used(i));
+        pmm_bitmap[get_bitmap_index(i)] |= BIT_MASK(get_bitmap_offset(i));
+    }
 }
 
-static inline void pmm_mark_used(physical_addr frame_addr) {
-    pmm_bitmap[get_bitmap_index(frame_addr)] |= BIT_MASK(get_bitmap_offset(frame_addr));
+static void pmm_debug_mark_free(size_t frame_index, size_t count) {
+    for (size_t i = frame_index; i < frame_index + count; i++) {
+        assert(pmm_debug_is_used(i)); // double free
+        pmm_bitmap[get_bitmap_index(i)] &= ~BIT_MASK(get_bitmap_offset(i));
+    }
 }
+#else
+static inline void pmm_debug_mark_used(size_t frame_index, size_t count, bool check) {}
+static inline void pmm_debug_mark_free(size_t frame_index, size_t count) {}
+#endif
 
-static inline void pmm_mark_free(physical_addr frame_addr) {
-    pmm_bitmap[get_bitmap_index(frame_addr)] &= ~BIT_MASK(get_bitmap_offset(frame_addr));
+// ---------------------------- Zones ----------------------------
+
+static inline size_t zone_end_frame(const zone_t *zone) {
+    return zone->first_frame + zone->buddy.units;
 }
 
-static inline bool is_full(size_t index) {
-    return pmm_bitmap[index] == 0xFF;
+static zone_t *zone_of(size_t frame_index) {
+    for (size_t i = PMM_ZONES_COUNT; i-- > 0;)
+        if (frame_index >= zones[i].first_frame)
+            return &zones[i];
+    return &zones[ZONE_DMA];
 }
 
+/*
+ * Allocates a block from the zone. A normal allocation falls back to the DMA zone as long as
+ * the DMA zone stays above its min watermark.
+ * return the first frame of the block or BUDDY_NO_BLOCK
+ */
+static size_t zone_alloc(pmm_zone_id_t zone_id, uint8_t order) {
+    zone_t *zone = &zones[zone_id];
+    size_t unit = buddy_alloc(&zone->buddy, order);
+    if (unit != BUDDY_NO_BLOCK)
+        return zone->first_frame + unit;
+    if (zone_id == ZONE_DMA)
+        return BUDDY_NO_BLOCK;
+
+    zone_t *dma_zone = &zones[ZONE_DMA];
+    if (dma_zone->buddy.free_units < dma_zone->watermark_min + ((size_t) 1 << order))
+        return BUDDY_NO_BLOCK;
+    unit = buddy_alloc(&dma_zone->buddy, order);
+    return unit == BUDDY_NO_BLOCK ? BUDDY_NO_BLOCK : dma_zone->first_frame + unit;
+}
 
+static void zone_free(size_t frame_index, uint8_t order) {
+    zone_t *zone = zone_of(frame_index);
+    buddy_free(&zone->buddy, frame_index - zone->first_frame, order);
+}
 
-// Allocate a single frame using next-fit strategy
-physical_addr pmm_alloc_frame() {
-    // Check if we can reuse the last freed frame
-    if (last_free_frame.index != -1 && last_free_frame.offset != -1) {
-        physical_addr frame_addr = calc_frame_addr(last_free_frame.index, last_free_frame.offset);
-        pmm_mark_used(frame_addr);
-        last_free_frame.index = -1;
-        last_free_frame.offset = -1;
-        return frame_addr;
+static bool zones_is_free(size_t frame_index) {
+    const zone_t *zone = zone_of(frame_index);
+    return buddy_is_free(&zone->buddy, frame_index - zone->first_frame);
+}
+
+// Calls the buddy range function of every zone on the part of [first, first + count) inside the zone
+static void zones_apply_range(size_t first, size_t count, void (*range_func)(buddy_t *, size_t, size_t)) {
+    for (size_t i = 0; i < PMM_ZONES_COUNT; i++) {
+        const size_t start = first > zones[i].first_frame ? first : zones[i].first_frame;
+        const size_t end = first + count < zone_end_frame(&zones[i]) ? first + count : zone_end_frame(&zones[i]);
+        if (start < end)
+            range_func(&zones[i].buddy, start - zones[i].first_frame, end - start);
     }
+}
 
-    // Use next-fit strategy to allocate a frame
-    for (size_t i = last_alloc_index; i < PMM_BITMAP_SIZE; i++) {
-        if (!is_full(i)) {
-            for (uint8_t j = 0; j < 8; j++) {
-                if (!(pmm_bitmap[i] & BIT_MASK(j))) {
-                    uint32_t frame_addr = calc_frame_addr(i, j);
-                    pmm_mark_used(frame_addr);
-                    last_alloc_index = i; // Update the next-fit index
-                    return frame_addr;
-                }
-            }
-        }
+static void zone_set_watermarks(zone_t *zone) {
+    // Like Linux, min is a small share of the zone and low and high are a quarter and a half above it
+    zone->watermark_min = zone->buddy.free_units / 64;
+    zone->watermark_low = zone->watermark_min + zone->watermark_min / 4;
+    zone->watermark_high = zone->watermark_min + zone->watermark_min / 2;
+}
+
+// The frame cache and the zeroed pool only hold frames of the normal zone
+static size_t zone_cached_frames(pmm_zone_id_t zone_id) {
+    return zone_id == ZONE_NORMAL ? frame_cache_count + zeroed_pool_count : 0;
+}
+
+pmm_zone_stats_t pmm_get_zone_stats(pmm_zone_id_t zone_id) {
+    assert(zone_id < PMM_ZONES_COUNT);
+    const zone_t *zone = &zones[zone_id];
+    const pmm_zone_stats_t stats = {
+        .first_frame = zone->first_frame,
+        .frames = zone->buddy.units,
+        .free_frames = zone->buddy.free_units,
+        .cached_frames = zone_cached_frames(zone_id),
+        .watermark_min = zone->watermark_min,
+        .watermark_low = zone->watermark_low,
+        .watermark_high = zone->watermark_high,
+    };
+    return stats;
+}
+
+bool pmm_zone_is_low(pmm_zone_id_t zone_id) {
+    assert(zone_id < PMM_ZONES_COUNT);
+    return zones[zone_id].buddy.free_units + zone_cached_frames(zone_id) < zones[zone_id].watermark_low;
+}
+
+// Marks [start, start + size) as used, the range doesn't have to be aligned
+static void pmm_reserve_range(physical_addr start, size_t size) {
+    const size_t first = get_frame_index(start);
+    size_t last = get_frame_index(ALIGNED_TO_PHYSICAL_PAGE(start + size));
+    if (last > total_frames)
+        last = total_frames; // memory that doesn't exist is never handed out anyway
+    if (first >= last)
+        return;
+    zones_apply_range(first, last - first, buddy_reserve_range);
+    pmm_debug_mark_used(first, last - first, false);
+}
+
+
+// Sets the descriptors of a block that was just allocated or freed
+static void set_frames_refcount(size_t frame_index, size_t count, uint16_t refcount) {
+    for (size_t i = frame_index; i < frame_index + count; i++) {
+        assert(!(frames[i].flags & PMM_FRAME_RESERVED));
+        assert(frames[i].refcount == 1 - refcount); // shared frames are put, not freed
+        frames[i].refcount = refcount;
+        frames[i].mapcount = 0;
     }
+}
+
+// ---------------------------- Free frame cache ----------------------------
+
+// Moves up to a batch of single frames from the buddy allocator to the cache
+static void frame_cache_refill() {
+    for (size_t i = 0; i < PMM_FRAME_CACHE_BATCH && frame_cache_count < PMM_FRAME_CACHE_SIZE; i++) {
+        const size_t frame_index = zone_alloc(ZONE_NORMAL, 0);
+        if (frame_index == BUDDY_NO_BLOCK)
+            break;
+        frame_cache[frame_cache_count++] = calc_frame_addr(frame_index);
+    }
+    frame_cache_stats.refills++;
+}
+
+// Gives `count` frames from the bottom of the cache back to the buddy allocator, those are the coldest ones
+static void frame_cache_drain(size_t count) {
+    if (count > frame_cache_count)
+        count = frame_cache_count;
+    for (size_t i = 0; i < count; i++)
+        zone_free(get_frame_index(frame_cache[i]), 0);
+    for (size_t i = count; i < frame_cache_count; i++)
+        frame_cache[i - count] = frame_cache[i];
+    frame_cache_count -= count;
+    frame_cache_stats.drains++;
+}
+
+static physical_addr frame_cache_pop() {
+    if (frame_cache_count == 0) {
+        frame_cache_stats.misses++;
+        frame_cache_refill();
+        if (frame_cache_count == 0)
+            return PMM_NO_FRAME_AVAILABLE;
+    } else
+        frame_cache_stats.hits++;
+    return frame_cache[--frame_cache_count];
+}
+
+static void frame_cache_push(physical_addr frame_addr) {
+    if (frame_cache_count == PMM_FRAME_CACHE_SIZE)
+        frame_cache_drain(PMM_FRAME_CACHE_BATCH);
+    frame_cache[frame_cache_count++] = frame_addr;
+}
+
+static bool frame_cache_contains(physical_addr frame_addr) {
+    for (size_t i = 0; i < frame_cache_count; i++)
+        if (frame_cache[i] == frame_addr)
+            return true;
+    return false;
+}
+
+static bool zeroed_pool_contains(physical_addr frame_addr) {
+    for (size_t i = 0; i < zeroed_pool_count; i++)
+        if (zeroed_pool[i] == frame_addr)
+            return true;
+    return false;
+}
+
+// Gives every zeroed frame back to the buddy allocator, the work is lost but the memory is needed
+static void zeroed_pool_drain() {
+    while (zeroed_pool_count > 0)
+        zone_free(get_frame_index(zeroed_pool[--zeroed_pool_count]), 0);
+}
+
+pmm_frame_cache_stats_t pmm_get_frame_cache_stats() {
+    pmm_frame_cache_stats_t stats = frame_cache_stats;
+    stats.cached = frame_cache_count;
+    return stats;
+}
+
+// ---------------------------- Shrinkers ----------------------------
+
+static pmm_shrinker_t shrinkers[PMM_MAX_SHRINKERS];
+static size_t shrinkers_count = 0;
+static bool shrinking = false;
+
+void pmm_register_shrinker(pmm_shrinker_t shrinker) {
+    if (shrinkers_count == PMM_MAX_SHRINKERS)
+        panic("Too many shrinkers, nobody is going to give that much memory back anyway");
+    shrinkers[shrinkers_count++] = shrinker;
+}
 
-    // Wrap around and continue searching from the beginning
-    for (size_t i = 1; i < last_alloc_index; i++) {
-        if (!is_full(i)) {
-            for (uint8_t j = 0; j < 8; j++) {
-                if (!(pmm_bitmap[i] & BIT_MASK(j))) {
-                    uint32_t frame_addr = calc_frame_addr(i, j);
-                    pmm_mark_used(frame_addr);
-                    last_alloc_index = i; // Update the next-fit index
-                    return frame_addr;
-                }
-            }
+size_t pmm_shrink(size_t frames_wanted) {
+    if (shrinking)
+        return 0; // a shrinker that allocates doesn't get to shrink itself
+    shrinking = true;
+    size_t freed = 0;
+    for (size_t i = 0; i < shrinkers_count && freed < frames_wanted; i++)
+        freed += shrinkers[i](frames_wanted - freed);
+    shrinking = false;
+    return freed;
+}
+
+// ---------------------------- PMM functions ----------------------------
+
+static physical_addr alloc_frames(pmm_zone_id_t zone, uint8_t order) {
+    // The cache and the zeroed pool hold normal frames, DMA allocations always go to the zone itself
+    if (order == 0 && zone == ZONE_NORMAL) {
+        physical_addr frame_addr = frame_cache_pop();
+        if (frame_addr == PMM_NO_FRAME_AVAILABLE && zeroed_pool_count > 0)
+            frame_addr = zeroed_pool[--zeroed_pool_count];
+        if (frame_addr != PMM_NO_FRAME_AVAILABLE) {
+            pmm_debug_mark_used(get_frame_index(frame_addr), 1, true);
+            set_frames_refcount(get_frame_index(frame_addr), 1, 1);
         }
+        return frame_addr;
     }
 
-    // No free frames available
-    return PMM_NO_FRAME_AVAILABLE;
+    size_t frame_index = zone_alloc(zone, order);
+    if (frame_index == BUDDY_NO_BLOCK && (frame_cache_count > 0 || zeroed_pool_count > 0)) {
+        // The cached frames may be the missing buddies, give them back and try again
+        frame_cache_drain(frame_cache_count);
+        zeroed_pool_drain();
+        frame_index = zone_alloc(zone, order);
+    }
+    if (frame_index == BUDDY_NO_BLOCK)
+        return PMM_NO_FRAME_AVAILABLE;
+    pmm_debug_mark_used(frame_index, (size_t) 1 << order, true);
+    set_frames_refcount(frame_index, (size_t) 1 << order, 1);
+    return calc_frame_addr(frame_index);
+}
+
+physical_addr pmm_alloc_frames_zone(pmm_zone_id_t zone, uint8_t order) {
+    assert(zone < PMM_ZONES_COUNT);
+    physical_addr frame_addr = alloc_frames(zone, order);
+    // Out of memory, ask the shrinkers to give some back and try again
+    if (frame_addr == PMM_NO_FRAME_AVAILABLE && pmm_shrink((size_t) 1 << order) > 0)
+        frame_addr = alloc_frames(zone, order);
+    return frame_addr;
+}
+
+physical_addr pmm_alloc_frames(uint8_t order) {
+    return pmm_alloc_frames_zone(ZONE_NORMAL, order);
+}
+
+physical_addr pmm_alloc_frame_zone(pmm_zone_id_t zone) {
+    return pmm_alloc_frames_zone(zone, 0);
+}
+
+void pmm_free_frames(physical_addr frame_addr, uint8_t order) {
+    assert(is_valid_frame_addr(frame_addr));
+    assert(frame_addr != PMM_NO_FRAME_AVAILABLE);
+    pmm_debug_mark_free(get_frame_index(frame_addr), (size_t) 1 << order);
+    set_frames_refcount(get_frame_index(frame_addr), (size_t) 1 << order, 0);
+    // DMA frames skip the cache so they are back in their zone right away
+    if (order == 0 && zone_of(get_frame_index(frame_addr)) == &zones[ZONE_NORMAL])
+        frame_cache_push(frame_addr);
+    else
+        zone_free(get_frame_index(frame_addr), order);
+}
+
+physical_addr pmm_alloc_zeroed_frame() {
+    if (zeroed_pool_count == 0) {
+        const physical_addr frame_addr = pmm_alloc_frame();
+        if (frame_addr != PMM_NO_FRAME_AVAILABLE)
+            vmm_zero_frame(frame_addr);
+        return frame_addr;
+    }
+    const physical_addr frame_addr = zeroed_pool[--zeroed_pool_count];
+    pmm_debug_mark_used(get_frame_index(frame_addr), 1, true);
+    set_frames_refcount(get_frame_index(frame_addr), 1, 1);
+    return frame_addr;
+}
+
+size_t pmm_zero_free_frames(size_t budget) {
+    size_t zeroed = 0;
+    while (zeroed < budget && zeroed_pool_count < PMM_ZEROED_POOL_SIZE) {
+        // Take the frames straight from the buddy allocator, the cached frames are the hot ones
+        const size_t frame_index = zone_alloc(ZONE_NORMAL, 0);
+        if (frame_index == BUDDY_NO_BLOCK)
+            break;
+        vmm_zero_frame(calc_frame_addr(frame_index));
+        zeroed_pool[zeroed_pool_count++] = calc_frame_addr(frame_index);
+        zeroed++;
+    }
+    return zeroed;
+}
+
+size_t pmm_get_zeroed_frames_count() {
+    return zeroed_pool_count;
+}
+
+// Allocate a single frame
+physical_addr pmm_alloc_frame() {
+    return pmm_alloc_frames(0);
 }
 
 // Free a previously allocated frame
 void pmm_free_frame(physical_addr frame_addr) {
-    assert(is_valid_frame_addr(frame_addr));
-    pmm_mark_free(frame_addr);
-    last_free_frame.index = get_bitmap_index(frame_addr);
-    last_free_frame.offset = get_bitmap_offset(frame_addr);
+    pmm_free_frames(frame_addr, 0);
+}
+
+pmm_frame_t *pmm_frame_of(physical_addr addr) {
+    const size_t frame_index = get_frame_index(addr);
+    return frame_index < total_frames ? &frames[frame_index] : NULL;
+}
+
+void pmm_frame_get(physical_addr frame_addr) {
+    pmm_frame_t *frame = pmm_frame_of(frame_addr);
+    assert(frame != NULL);
+    if (frame->flags & PMM_FRAME_RESERVED)
+        return;
+    assert(frame->refcount > 0 && frame->refcount < 0xFFFF); // taking a reference on a free frame
+    frame->refcount++;
+}
+
+bool pmm_frame_put(physical_addr frame_addr) {
+    pmm_frame_t *frame = pmm_frame_of(frame_addr);
+    if (frame == NULL || frame->flags & PMM_FRAME_RESERVED)
+        return false;
+    assert(frame->refcount > 0); // double put
+    if (frame->refcount > 1) {
+        frame->refcount--;
+        return false;
+    }
+    pmm_free_frame(frame_addr & ~(PMM_BLOCK_SIZE - 1));
+    return true;
 }
 
 bool pmm_is_frame_free(physical_addr frame_addr) {
     assert(is_valid_frame_addr(frame_addr));
-    return !(pmm_bitmap[get_bitmap_index(frame_addr)] & BIT_MASK(get_bitmap_offset(frame_addr)));
+    const bool is_free = zones_is_free(get_frame_index(frame_addr)) ||
+                         frame_cache_contains(frame_addr) || zeroed_pool_contains(frame_addr);
+#ifdef PMM_DEBUG
+    assert(is_free == !pmm_debug_is_used(get_frame_index(frame_addr)));
+#endif
+    return is_free;
 }
 
-// Initialize the Physical Memory Manager
-void pmm_init() {
-    // Initialize the bitmap (mark all frames as free)
-    for (size_t i = 0; i < PMM_BITMAP_SIZE; i++) {
-        pmm_bitmap[i] = 0;
+size_t pmm_get_free_frames_count() {
+    size_t free_frames = frame_cache_count + zeroed_pool_count;
+    for (size_t i = 0; i < PMM_ZONES_COUNT; i++)
+        free_frames += zones[i].buddy.free_units;
+    return free_frames;
+}
+
+size_t pmm_get_total_frames_count() {
+    return total_frames;
+}
+
+physical_addr pmm_get_kernel_reserved_end() {
+    return kernel_reserved_end;
+}
+
+// ---------------------------- Boot time functions ----------------------------
+
+static void add_usable_region(uint64_t start, uint64_t len) {
+    const uint64_t max_addr = 0x100000000ull; // 32 bit physical addresses only
+    if (start >= max_addr || len == 0)
+        return;
+    uint64_t end = start + len > max_addr ? max_addr : start + len;
+    // Merge with the regions it overlaps or touches, a firmware may report a range in pieces
+    for (size_t i = 0; i < usable_regions_count;) {
+        if (usable_regions[i].start <= end && start <= usable_regions[i].end) {
+            if (usable_regions[i].start < start)
+                start = usable_regions[i].start;
+            if (usable_regions[i].end > end)
+                end = usable_regions[i].end;
+            usable_regions[i] = usable_regions[--usable_regions_count];
+        } else
+            i++;
+    }
+    if (usable_regions_count == PMM_MAX_MEMORY_REGIONS) {
+        printf("Too many usable memory regions, dropping %x - %x\n", (uint32_t) start, (uint32_t) (end - 1));
+        return;
     }
+    usable_regions[usable_regions_count].start = start;
+    usable_regions[usable_regions_count].end = end;
+    usable_regions_count++;
+}
+
+static void read_memory_map(const multiboot_info_t *multiboot_info) {
+    if (multiboot_info == NULL)
+        panic("No multiboot info, I have no idea how much memory this computer has");
+
+    if (multiboot_info->flags & MULTIBOOT_INFO_MEM_MAP) {
+        uint32_t entry_addr = multiboot_info->mmap_addr;
+        const uint32_t mmap_end = multiboot_info->mmap_addr + multiboot_info->mmap_length;
+        while (entry_addr < mmap_end) {
+            const multiboot_mmap_entry_t *entry = (const multiboot_mmap_entry_t *) entry_addr;
+            if (entry->type == MULTIBOOT_MEMORY_AVAILABLE)
+                add_usable_region(entry->addr, entry->len);
+            entry_addr += entry->size + sizeof(entry->size);
+        }
+    } else if (multiboot_info->flags & MULTIBOOT_INFO_MEMORY) {
+        // No map, only the size of the lower and the upper memory
+        add_usable_region(0, (uint64_t) multiboot_info->mem_lower * 1024);
+        add_usable_region(KERNEL_RESERVED_MEMORY, (uint64_t) multiboot_info->mem_upper * 1024);
+    } else
+        panic("The bootloader didn't give a memory map, I refuse to guess how much memory there is");
+
+    if (usable_regions_count == 0)
+        panic("The memory map has no usable memory. How are we even running?");
+}
+
+static bool is_usable_range(uint64_t start, uint64_t end) {
+    for (size_t i = 0; i < usable_regions_count; i++)
+        if (usable_regions[i].start <= start && end <= usable_regions[i].end)
+            return true;
+    return false;
+}
+
+// Allocates zeroed metadata right after the kernel image, only valid before paging is enabled
+static void *pmm_boot_alloc(size_t size) {
+    void *ptr = (void *) kernel_reserved_end;
+    size = (size + sizeof(uint32_t) - 1) & ~(sizeof(uint32_t) - 1);
+    for (size_t i = 0; i < size; i++)
+        ((uint8_t *) ptr)[i] = 0;
+    kernel_reserved_end += size;
+    return ptr;
+}
 
-    // Reserve memory for kernel and hardware
+// Initialize the Physical Memory Manager
+void pmm_init(const multiboot_info_t *multiboot_info) {
+    read_memory_map(multiboot_info);
+
+    // The PMM manages the frames up to the end of the highest usable region
+    uint64_t memory_end = 0;
+    for (size_t i = 0; i < usable_regions_count; i++)
+        if (usable_regions[i].end > memory_end)
+            memory_end = usable_regions[i].end;
+    total_frames = memory_end / PMM_BLOCK_SIZE;
+    const size_t dma_frames = total_frames < PMM_DMA_ZONE_END / PMM_BLOCK_SIZE ?
+                              total_frames : PMM_DMA_ZONE_END / PMM_BLOCK_SIZE;
+
+    // Carve the metadata after the kernel image
     extern char _kernel_start, _kernel_end;
-    size_t kernel_size = (size_t) (&_kernel_end - &_kernel_start);
-    size_t kernel_frames = (kernel_size + PMM_BLOCK_SIZE - 1) / PMM_BLOCK_SIZE;
-    for (size_t i = 0; i < kernel_frames; i++)
-        pmm_mark_used(((physical_addr) &_kernel_start) + i * PMM_BLOCK_SIZE);
+    kernel_reserved_end = ALIGNED_TO_PHYSICAL_PAGE((physical_addr) &_kernel_end);
+    uint32_t *dma_metadata = pmm_boot_alloc(BUDDY_METADATA_WORDS(dma_frames) * sizeof(uint32_t));
+    uint32_t *normal_metadata = pmm_boot_alloc(BUDDY_METADATA_WORDS(total_frames - dma_frames) * sizeof(uint32_t));
+    frames = pmm_boot_alloc(total_frames * sizeof(pmm_frame_t));
+#ifdef PMM_DEBUG
+    pmm_bitmap = pmm_boot_alloc((total_frames + 7) / 8);
+#endif
+    kernel_reserved_end = ALIGNED_TO_PHYSICAL_PAGE(kernel_reserved_end);
+    if (!is_usable_range((physical_addr) &_kernel_start, kernel_reserved_end))
+        panic("Not enough memory after the kernel for the PMM metadata");
+
+    // Initialize the zones, only the usable regions are free
+    zones[ZONE_DMA].first_frame = 0;
+    buddy_init(&zones[ZONE_DMA].buddy, dma_frames, dma_metadata);
+    zones[ZONE_NORMAL].first_frame = dma_frames;
+    buddy_init(&zones[ZONE_NORMAL].buddy, total_frames - dma_frames, normal_metadata);
+    for (size_t i = 0; i < usable_regions_count; i++) {
+        const size_t first = (usable_regions[i].start + PMM_BLOCK_SIZE - 1) / PMM_BLOCK_SIZE;
+        const size_t last = usable_regions[i].end / PMM_BLOCK_SIZE;
+        if (last > first)
+            zones_apply_range(first, last - first, buddy_free_range);
+    }
+#ifdef PMM_DEBUG
+    for (size_t i = 0; i < total_frames; i++)
+        if (!zones_is_free(i))
+            pmm_debug_mark_used(i, 1, false);
+#endif
+
+    // Reserve the low memory - BIOS data, the VGA buffer and frame 0 which is PMM_NO_FRAME_AVAILABLE
+    pmm_reserve_range(0, KERNEL_RESERVED_MEMORY);
+
+    // Reserve the kernel image and the metadata after it
+    pmm_reserve_range((physical_addr) &_kernel_start, kernel_reserved_end - (physical_addr) &_kernel_start);
 
     // map Kernel stack
     extern const unsigned int _kernel_stack_top, _kernel_stack_pages_amount;
+    const physical_addr stack_end = ALIGNED_TO_PHYSICAL_PAGE((physical_addr) _kernel_stack_top);
+    pmm_reserve_range(stack_end - _kernel_stack_pages_amount * PMM_BLOCK_SIZE,
+                      _kernel_stack_pages_amount * PMM_BLOCK_SIZE);
 
-    for (size_t i = 0; i < _kernel_stack_pages_amount; i++)
-        pmm_mark_used((physical_addr) _kernel_stack_top - i * PMM_BLOCK_SIZE);
 
-    // Map heap address
-    KERNEL_BASE_HEAP_ADDR = ALIGNED_TO_PHYSICAL_PAGE((uint32_t) _kernel_stack_top);
-    size_t num_pages = KERNEL_HEAP_SIZE / PMM_BLOCK_SIZE;
-    for (size_t i = 0; i < num_pages; i++) {
-        pmm_mark_used((physical_addr) (KERNEL_BASE_HEAP_ADDR + i * PMM_BLOCK_SIZE));
+    // Whatever is not free now is never handed out
+    for (size_t i = 0; i < total_frames; i++) {
+        frames[i].lru_prev = frames[i].lru_next = PMM_FRAME_NO_LINK;
+        if (!zones_is_free(i))
+            frames[i].flags = PMM_FRAME_RESERVED;
     }
 
-    // Map the VGA buffer
-    pmm_mark_used(VGA_ADDRESS);
-}
\ No newline at end of file
+    for (size_t i = 0; i < PMM_ZONES_COUNT; i++)
+        zone_set_watermarks(&zones[i]);
+}
@@ -7,20 +7,156 @@
 
 #include "../std/stdint.h"
 #include <stdbool.h>
+#include "buddy.h"
+#include "../multiboot.h"
 
 // Memory Configuration
-#define MEMORY_SIZE 0x100000000u // 4GB
 #define PMM_BLOCK_SIZE 4096u     // 4KB
-#define PMM_BITMAP_SIZE (MEMORY_SIZE / PMM_BLOCK_SIZE / 8u) // 4GB / 4KB / 8 = 512KB
+#define PMM_MAX_MEMORY_REGIONS 32u // Entries of the bootloader memory map that are kept
 #define PMM_NO_FRAME_AVAILABLE 0
+#define PMM_MAX_ORDER BUDDY_MAX_ORDER // the biggest contiguous allocation is 2^PMM_MAX_ORDER frames (4MB)
+#define PMM_FRAME_CACHE_SIZE 64u  // Single frames kept on the free frame cache
+#define PMM_FRAME_CACHE_BATCH 16u // Frames moved between the cache and the buddy allocator at once
+#define PMM_ZEROED_POOL_SIZE 64u   // Frames that are zeroed ahead of time for pmm_alloc_zeroed_frame
+#define PMM_MAX_SHRINKERS 4u
+#define PMM_DMA_ZONE_END 0x1000000u // 16MB, the memory ISA DMA can reach
 #define ALIGNED_TO_PHYSICAL_PAGE(addr) ((addr + PMM_BLOCK_SIZE - 1) & ~(PMM_BLOCK_SIZE - 1))
 
 // Kernel reserved memory (e.g., first 1 MB)
 #define KERNEL_RESERVED_MEMORY (1 * 1024 * 1024)
 typedef uint32_t physical_addr;
-void pmm_init();
+
+typedef enum {
+    ZONE_DMA,    // Below PMM_DMA_ZONE_END, the VMM keeps it identity mapped
+    ZONE_NORMAL, // Everything above it
+    PMM_ZONES_COUNT
+} pmm_zone_id_t;
+
+/*
+ * Builds the PMM from the memory map the bootloader gave. Only the memory it reports as usable is handed out,
+ * and the metadata is sized from the real amount of memory and placed right after the kernel image.
+ * Must run before paging is enabled.
+ */
+void pmm_init(const multiboot_info_t *multiboot_info);
 physical_addr pmm_alloc_frame();
 void pmm_free_frame(physical_addr frame_addr);
 bool pmm_is_frame_free(physical_addr frame_addr);
 
+/*
+ * Allocates 2^order physically contiguous frames, aligned to their size.
+ * return the address of the first frame or PMM_NO_FRAME_AVAILABLE
+ */
+physical_addr pmm_alloc_frames(uint8_t order);
+
+/*
+ * Like pmm_alloc_frames but from a specific zone. ZONE_NORMAL allocations may fall back to ZONE_DMA while it
+ * is above its min watermark, ZONE_DMA allocations never leave ZONE_DMA.
+ */
+physical_addr pmm_alloc_frames_zone(pmm_zone_id_t zone, uint8_t order);
+physical_addr pmm_alloc_frame_zone(pmm_zone_id_t zone);
+
+/*
+ * Frees 2^order contiguous frames that were allocated by pmm_alloc_frames, the frames must not be shared.
+ * Freeing a part of an allocation is allowed as long as the part is aligned to its own order.
+ */
+void pmm_free_frames(physical_addr frame_addr, uint8_t order);
+
+/*
+ * Allocates a frame that is filled with zeros. It comes from the pool of frames that were zeroed while the
+ * kernel was idle, if the pool is empty the frame is zeroed on the spot.
+ * return the address of the frame or PMM_NO_FRAME_AVAILABLE
+ */
+physical_addr pmm_alloc_zeroed_frame();
+
+/*
+ * Zeroes up to `budget` free frames and puts them on the zeroed pool, meant to be called when there is
+ * nothing better to do.
+ * return the amount of frames that were zeroed
+ */
+size_t pmm_zero_free_frames(size_t budget);
+
+size_t pmm_get_zeroed_frames_count();
+
+/*
+ * A shrinker gives memory back to the PMM when an allocation would fail (e.g. kmalloc frees its empty slabs).
+ * return the amount of frames it freed
+ */
+typedef size_t (*pmm_shrinker_t)(size_t frames_wanted);
+void pmm_register_shrinker(pmm_shrinker_t shrinker);
+
+/*
+ * Runs the shrinkers until `frames_wanted` frames were freed, the allocation functions call it on their own
+ * when they run out of frames.
+ * return the amount of frames freed
+ */
+size_t pmm_shrink(size_t frames_wanted);
+
+// Free frames, including the frames sitting on the free frame cache and on the zeroed pool
+size_t pmm_get_free_frames_count();
+
+// Amount of frames the PMM manages, up to the end of the highest usable memory region
+size_t pmm_get_total_frames_count();
+
+/*
+ * The end of the memory reserved for the kernel at boot - the kernel image and the PMM metadata after it.
+ * [_kernel_start, pmm_get_kernel_reserved_end()) must stay identity mapped.
+ */
+physical_addr pmm_get_kernel_reserved_end();
+
+/*
+ * Descriptor of a physical frame, the PMM keeps one for every frame it manages, indexed by the frame number.
+ * A frame that is handed out starts with a single reference, owners that share it (e.g. page tables that
+ * are copied to a new vm context) take more with pmm_frame_get and the frame is freed by the last pmm_frame_put.
+ */
+typedef struct {
+    uint16_t refcount; // Owners of the frame, 0 when the frame is free
+    uint16_t mapcount; // Page table entries that map the frame, kept by the VMM
+    uint32_t flags;    // PMM_FRAME_* flags
+    uint32_t lru_prev; // Frame numbers of the neighbours in a reclaim (LRU) list, PMM_FRAME_NO_LINK if none
+    uint32_t lru_next;
+    uint32_t vir_addr; // The page that maps the frame while it is in a reclaim list
+    uint32_t last_use; // When the page was last seen accessed, in page faults, kept by the replacement policy
+} pmm_frame_t;
+
+#define PMM_FRAME_RESERVED 0x1 // The frame is never handed out (kernel image, BIOS, holes), references are ignored
+#define PMM_FRAME_ACTIVE 0x2   // The page is in the active (frequently used) reclaim list of the replacement policy
+#define PMM_FRAME_NO_LINK ((uint32_t) -1)
+
+// Returns the descriptor of the frame that contains the address, NULL if the PMM doesn't manage it
+pmm_frame_t *pmm_frame_of(physical_addr addr);
+
+// Takes another reference on an allocated frame
+void pmm_frame_get(physical_addr frame_addr);
+
+/*
+ * Drops a reference of a frame, the last reference frees it.
+ * return true if the frame was freed
+ */
+bool pmm_frame_put(physical_addr frame_addr);
+
+typedef struct {
+    size_t first_frame;
+    size_t frames;         // Frames the zone spans, holes included
+    size_t free_frames;    // Free frames in the zone, not counting the frame cache and the zeroed pool
+    size_t cached_frames;  // Free frames of the zone that the frame cache and the zeroed pool hold
+    size_t watermark_min;  // Normal allocations don't fall back into the DMA zone below it
+    size_t watermark_low;  // Below it the zone is low on memory and reclaim should start
+    size_t watermark_high; // Reclaim can stop above it
+} pmm_zone_stats_t;
+
+pmm_zone_stats_t pmm_get_zone_stats(pmm_zone_id_t zone);
+
+// return true if the free frames of the zone, the cached ones included, are below its low watermark
+bool pmm_zone_is_low(pmm_zone_id_t zone);
+
+typedef struct {
+    size_t hits;    // Single frame allocations served straight from the cache
+    size_t misses;  // Single frame allocations that had to refill the cache from the buddy allocator
+    size_t refills; // Batches moved from the buddy allocator to the cache
+    size_t drains;  // Batches moved from the cache back to the buddy allocator
+    size_t cached;  // Frames on the cache right now
+} pmm_frame_cache_stats_t;
+
+pmm_frame_cache_stats_t pmm_get_frame_cache_stats();
+
 #endif // MYKERNELPROJECT_PMM_H
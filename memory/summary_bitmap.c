@@ -0,0 +1,67 @@
+//
+// Created by Yoav on 10/18/2026.
+//
+
+#include "summary_bitmap.h"
+
+#define BITS_PER_WORD 32u
+
+// Index of the lowest set bit, the word must not be zero
+static inline uint32_t bit_scan_forward(uint32_t word) {
+    uint32_t index;
+    asm ("bsf %1, %0" : "=r"(index) : "rm"(word));
+    return index;
+}
+
+size_t summary_bitmap_init(summary_bitmap_t *bitmap, size_t bits, uint32_t *storage) {
+    size_t used = 0;
+    size_t level_bits = bits;
+    bitmap->bits = bits;
+    for (uint8_t level = 0; level < SUMMARY_BITMAP_LEVELS; level++) {
+        const size_t words = (level_bits + BITS_PER_WORD - 1) / BITS_PER_WORD;
+        bitmap->level[level] = storage + used;
+        bitmap->words[level] = words;
+        for (size_t i = 0; i < words; i++)
+            bitmap->level[level][i] = 0;
+        used += words;
+        level_bits = words;
+    }
+    return used;
+}
+
+void summary_bitmap_set(summary_bitmap_t *bitmap, size_t bit) {
+    // Go up only while the word was empty, otherwise the summary bit above is already set
+    for (uint8_t level = 0; level < SUMMARY_BITMAP_LEVELS; level++) {
+        uint32_t *word = &bitmap->level[level][bit / BITS_PER_WORD];
+        const bool was_empty = *word == 0;
+        *word |= 1u << (bit % BITS_PER_WORD);
+        if (!was_empty)
+            return;
+        bit /= BITS_PER_WORD;
+    }
+}
+
+void summary_bitmap_clear(summary_bitmap_t *bitmap, size_t bit) {
+    // Go up only while the word became empty
+    for (uint8_t level = 0; level < SUMMARY_BITMAP_LEVELS; level++) {
+        uint32_t *word = &bitmap->level[level][bit / BITS_PER_WORD];
+        *word &= ~(1u << (bit % BITS_PER_WORD));
+        if (*word != 0)
+            return;
+        bit /= BITS_PER_WORD;
+    }
+}
+
+size_t summary_bitmap_find_first(const summary_bitmap_t *bitmap) {
+    const uint32_t *top = bitmap->level[SUMMARY_BITMAP_LEVELS - 1];
+    for (size_t i = 0; i < bitmap->words[SUMMARY_BITMAP_LEVELS - 1]; i++) {
+        if (top[i] == 0)
+            continue;
+        // Walk down, every summary bit points at a non empty word in the level below
+        size_t index = i * BITS_PER_WORD + bit_scan_forward(top[i]);
+        for (int level = SUMMARY_BITMAP_LEVELS - 2; level >= 0; level--)
+            index = index * BITS_PER_WORD + bit_scan_forward(bitmap->level[level][index]);
+        return index;
+    }
+    return SUMMARY_BITMAP_NONE;
+}
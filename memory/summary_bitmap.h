@@ -0,0 +1,48 @@
+//
+// Created by Yoav on 10/18/2026.
+//
+
+/*
+ * A bitmap with two summary levels on top of it, so finding a set bit costs a handful of word loads
+ * no matter how sparse the bitmap is.
+ * level[0] holds the bits themselves, bit j of level[1] is set if word j of level[0] is not zero,
+ * and bit j of level[2] is set if word j of level[1] is not zero.
+ * The search only scans level[2] linearly - 32 words cover 2^20 bits (4GB worth of frames).
+ */
+
+#ifndef MYKERNEL_SUMMARY_BITMAP_H
+#define MYKERNEL_SUMMARY_BITMAP_H
+
+#include "../std/stdint.h"
+#include "../std/stdbool.h"
+
+#define SUMMARY_BITMAP_LEVELS 3u
+#define SUMMARY_BITMAP_NONE ((size_t) -1)
+
+// Upper bound of the amount of 32 bit words needed for a bitmap of `bits` bits
+#define SUMMARY_BITMAP_WORDS(bits) ((bits) / 32u + (bits) / 1024u + (bits) / 32768u + SUMMARY_BITMAP_LEVELS)
+
+typedef struct {
+    size_t bits;
+    uint32_t *level[SUMMARY_BITMAP_LEVELS];
+    size_t words[SUMMARY_BITMAP_LEVELS];
+} summary_bitmap_t;
+
+/*
+ * Initializes the bitmap with all the bits cleared.
+ * @param storage at least SUMMARY_BITMAP_WORDS(bits) words
+ * @return the amount of words of storage used
+ */
+size_t summary_bitmap_init(summary_bitmap_t *bitmap, size_t bits, uint32_t *storage);
+
+void summary_bitmap_set(summary_bitmap_t *bitmap, size_t bit);
+void summary_bitmap_clear(summary_bitmap_t *bitmap, size_t bit);
+
+// Returns the lowest set bit or SUMMARY_BITMAP_NONE if no bit is set
+size_t summary_bitmap_find_first(const summary_bitmap_t *bitmap);
+
+static inline bool summary_bitmap_test(const summary_bitmap_t *bitmap, size_t bit) {
+    return bit < bitmap->bits && (bitmap->level[0][bit / 32] & (1u << (bit % 32)));
+}
+
+#endif //MYKERNEL_SUMMARY_BITMAP_H
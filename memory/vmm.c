@@ -9,6 +9,9 @@
 #include "../errors.h"
 #include "../drivers/disk.h"
 #include "kmalloc.h"
+#include "arena.h"
+#include "page_replacement.h"
+#include "kswapd.h"
 #include "../drivers/screen.h"
 
 
@@ -21,18 +24,11 @@ page_directory_t *vmm_get_kernel_page_directory() {
     return &kernel_directory;
 }
 
-typedef struct page_fifo_node {
-    void *vir_addr;
-    struct page_fifo_node *next;
-} page_fifo_node_t;
 
-typedef struct {
-    page_fifo_node_t *head;
-    page_fifo_node_t *tail;
-    size_t count;
-} page_fifo_queue_t;
-
-static page_fifo_queue_t current_page_fifo_queue = {NULL, NULL, 0};
+// The pages the last swap in read ahead of the faulting page, graded by the next swap in
+static uint32_t readahead_start = 0;
+static size_t readahead_pages = 0;
+static size_t readahead_window = VMM_SWAP_READAHEAD_MIN * 2; // Pages to read on a swap in fault, adapts to the hits
 
 static page_entry_t *vmm_get_page_entry(void *vir_addr);
 
@@ -55,6 +51,15 @@ static inline uint32_t get_frame_addr(const page_entry_t entry) {
     return entry & 0xFFFFF000;
 }
 
+// A directory entry that maps a 4MB page directly instead of pointing to a page table
+static inline bool is_large_page(const page_entry_t entry) {
+    return (entry & (PRESENT | PAGE_SIZE_BIT)) == (PRESENT | PAGE_SIZE_BIT);
+}
+
+static inline uint32_t get_large_frame_addr(const page_entry_t entry) {
+    return entry & ~(LARGE_PAGE_SIZE - 1);
+}
+
 static inline uint32_t get_page_table_addr(const page_directory_t *dir, uint16_t pd_index) {
     if (paging_enabled) //Todo add that this is the likely case
         return get_page_table_vir_addr(dir, pd_index);
@@ -72,6 +77,34 @@ static inline void load_page_dir(physical_addr page_dir_addr) {
     asm volatile ("mov %0, %%cr3"::"r"(page_dir_addr));
 }
 
+// Disables the interrupts and returns the flags to restore with restore_interrupts
+static inline uint32_t save_and_disable_interrupts() {
+    uint32_t eflags;
+    asm volatile ("pushf; pop %0; cli" : "=r"(eflags) :: "memory");
+    return eflags;
+}
+
+static inline void restore_interrupts(uint32_t eflags) {
+    asm volatile ("push %0; popf" :: "r"(eflags) : "memory", "cc");
+}
+
+// Zeroes a page with 32 bit stores, much faster than the byte by byte memset
+static inline void zero_page(void *page) {
+    uint32_t dwords = PAGE_SIZE / sizeof(uint32_t);
+    asm volatile ("rep stosl" : "+D"(page), "+c"(dwords) : "a"(0) : "memory");
+}
+
+static inline void copy_page(void *dest, const void *src) {
+    uint32_t dwords = PAGE_SIZE / sizeof(uint32_t);
+    asm volatile ("rep movsl" : "+D"(dest), "+S"(src), "+c"(dwords) :: "memory");
+}
+
+static inline physical_addr get_loaded_page_dir() {
+    physical_addr page_dir_addr;
+    asm volatile ("mov %%cr3, %0" : "=r"(page_dir_addr));
+    return page_dir_addr;
+}
+
 static inline void page_entry_set_frame(page_entry_t *const e, const uint32_t frame_addr) {
     *e = (*e & ~0xFFFFF000) | frame_addr;
 }
@@ -89,6 +122,28 @@ static inline bool is_swapped(const page_entry_t e) {
     return e & SWAPPED;
 }
 
+// A swapped page entry keeps the first swap slot of the page where the frame address would be
+static inline uint32_t get_swap_slot(const page_entry_t e) {
+    return e >> 12;
+}
+
+static inline void page_entry_set_swap_slot(page_entry_t *const e, const uint32_t disk_slot) {
+    *e = (*e & 0xFFF) | (disk_slot << 12);
+}
+
+// Keeps the mapcount of the frame descriptor, frames the PMM doesn't manage (e.g. MMIO) have none
+static inline void frame_mapped(physical_addr frame_addr) {
+    pmm_frame_t *frame = pmm_frame_of(frame_addr);
+    if (frame != NULL)
+        frame->mapcount++;
+}
+
+static inline void frame_unmapped(physical_addr frame_addr) {
+    pmm_frame_t *frame = pmm_frame_of(frame_addr);
+    if (frame != NULL && frame->mapcount > 0)
+        frame->mapcount--;
+}
+
 static inline bool is_page_present_error(const uint32_t error_code) {
     return error_code & 0x1;
 }
@@ -101,9 +156,19 @@ static inline bool is_page_user_error(const uint32_t error_code) {
     return error_code & 0x4;
 }
 
-static inline bool is_cow(page_entry_t *e) {
-    //todo after the cow mechanism is implemented return *e & COW
-    return false;
+static inline bool is_cow(const page_entry_t e) {
+    return e & COW;
+}
+
+// A page table of user pages, it is private to the vm context so a copy of the context gets its own
+static inline bool is_user_table(const page_entry_t pde) {
+    return (pde & PAGE_USER) && (is_page_present(pde) || is_swapped(pde)) && !is_large_page(pde);
+}
+
+// Only frames the PMM counts the owners of can be shared copy on write, the rest (e.g. MMIO) are shared as is
+static inline bool can_be_cow(const physical_addr frame_addr) {
+    const pmm_frame_t *frame = pmm_frame_of(frame_addr);
+    return frame != NULL && !(frame->flags & PMM_FRAME_RESERVED);
 }
 
 static inline uint16_t get_frame_offset(void *vir_addr) {
@@ -121,63 +186,51 @@ static inline void flush_page(uint32_t vir_addr) {
     asm volatile ("invlpg (%0)"::"r"(vir_addr) : "memory");
 }
 
-static inline uint32_t disk_alloc_slots_for_page() {
+static inline uint32_t disk_sectors_per_page() {
     const uint32_t sector_size = disk_get_current_disk_logical_sector_size();
-    const uint32_t sector_amount = PAGE_SIZE / sector_size + (PAGE_SIZE % sector_size != 0);
-    return disk_alloc_slots(sector_amount);
+    return PAGE_SIZE / sector_size + (PAGE_SIZE % sector_size != 0);
 }
 
-static inline void disk_free_slots_for_page(const uint32_t start_slot) {
-    const uint32_t sector_size = disk_get_current_disk_logical_sector_size();
-    const uint32_t sector_amount = PAGE_SIZE / sector_size + (PAGE_SIZE % sector_size != 0);
-    disk_free_slots(start_slot, sector_amount);
+static inline uint32_t disk_alloc_slots_for_page() {
+    return disk_alloc_slots(disk_sectors_per_page());
 }
 
-// ---------------------------- Page FIFO Algorithm ----------------------------
-
-
-static void page_fifo_enqueue(page_fifo_node_t *node) {
-    if (current_page_fifo_queue.head == NULL)
-        current_page_fifo_queue.head = current_page_fifo_queue.tail = node;
-    else {
-        current_page_fifo_queue.tail->next = node;
-        current_page_fifo_queue.tail = node;
-    }
-    current_page_fifo_queue.count++;
+// Slots are shared by the vm contexts a fork copied a swapped out page to, every page entry holds a reference
+static inline void disk_get_slots_for_page(const uint32_t start_slot) {
+    disk_get_slots(start_slot, disk_sectors_per_page());
 }
 
-static bool page_enqueue(void *vir_addr) {
-    page_fifo_node_t *node = (page_fifo_node_t *) kmalloc(sizeof(page_fifo_node_t));
-    if (node == NULL)
-        return false;
-
-    node->vir_addr = vir_addr;
-    node->next = NULL;
-    page_fifo_enqueue(node);
-    return true;
-}
-
-static void *page_fifo_dequeue() {
-    if (current_page_fifo_queue.head == NULL)
-        return NULL;
-    page_fifo_node_t *node = current_page_fifo_queue.head;
-    current_page_fifo_queue.head = current_page_fifo_queue.head->next;
-    current_page_fifo_queue.count--;
-    void *vir_addr = node->vir_addr;
-    kfree(node);
-    return vir_addr;
+static inline void disk_put_slots_for_page(const uint32_t start_slot) {
+    disk_free_slots(start_slot, disk_sectors_per_page());
 }
 
+// ---------------------------- Page replacement ----------------------------
 
+// Drops the reference a page has on its frame, a frame that is freed stops being tracked by the policy first
+static void vmm_put_frame(physical_addr frame_addr) {
+    const pmm_frame_t *frame = pmm_frame_of(frame_addr);
+    if (frame != NULL && frame->refcount == 1)
+        page_replacement_page_out(frame_addr);
+    pmm_frame_put(frame_addr);
+}
 
 // ---------------------------- VMM functions ----------------------------
 
 
 
+// CR4.PSE allows 4MB pages and CR4.PGE keeps the global pages in the TLB when CR3 is reloaded
+static void enable_large_and_global_pages() {
+    uint32_t cr4;
+    asm volatile ("mov %%cr4, %0" : "=r"(cr4));
+    cr4 |= 0x10 | 0x80;
+    asm volatile ("mov %0, %%cr4"::"r"(cr4));
+}
+
 void enable_paging() {
     uint32_t cr0;
     asm volatile ("mov %%cr0, %0" : "=r"(cr0));
     cr0 |= 0x80000000; // Set the paging bit in cr0
+    cr0 |= 0x10000;    // Write protect, so the writes of the kernel to copy on write pages fault too
     asm volatile ("mov %0, %%cr0"::"r"(cr0));
     paging_enabled = true;
 }
@@ -192,9 +245,57 @@ void vmm_switch_vm_context(const vm_context_t *vm_context) {
 }
 
 
+/*
+ * Returns the page entry of the page in the current directory, NULL if its page table is not in memory.
+ * Unlike vmm_get_page_entry it never swaps in the page table
+ */
+static page_entry_t *vmm_find_page_entry(void *vir_addr) {
+    const uint32_t pd_index = get_directory_index(vir_addr);
+    if (!is_page_present(current_directory->tables[pd_index]))
+        return NULL;
+    if (is_large_page(current_directory->tables[pd_index]))
+        return &current_directory->tables[pd_index];
+    page_table_t *page_table = (page_table_t *) get_page_table_addr(current_directory, pd_index);
+    return &page_table->entries[get_table_index(vir_addr)];
+}
+
+page_access_t vmm_page_test_and_clear_accessed(physical_addr frame_addr) {
+    const pmm_frame_t *frame = pmm_frame_of(frame_addr);
+    if (frame == NULL || frame->refcount > 1)
+        return PAGE_NOT_EVICTABLE;
+    page_entry_t *e = vmm_find_page_entry((void *) frame->vir_addr);
+    if (e == NULL || !is_page_present(*e) || get_frame_addr(*e) != frame_addr)
+        return PAGE_NOT_EVICTABLE; // the page is mapped only in another vm context
+    if (!(*e & ACCESSED))
+        return PAGE_IDLE;
+    page_entry_remove_attrib(e, ACCESSED);
+    flush_page(frame->vir_addr);
+    return PAGE_ACCESSED;
+}
+
 // return the page to swap out if there is no page to swap out return NULL
 static void *vmm_get_page_to_swap_out() {
-    return page_fifo_dequeue();
+    return page_replacement_choose_victim();
+}
+
+// The page tables are paged too, they are seen through the recursive mapping
+static inline bool is_page_table_addr(void *vir_addr) {
+    return get_directory_index(vir_addr) == RECURSIVE_PAGE_TABLE_INDEX;
+}
+
+// Points the page entry to the swap slot the page was written to and drops its frame
+static void vmm_page_swapped_out(page_entry_t *e, void *vir_addr, uint32_t disk_slot) {
+    // the frame stays alive if another vm context still maps it
+    const physical_addr frame_addr = get_frame_addr(*e);
+    page_replacement_evicted(frame_addr);
+    frame_unmapped(frame_addr);
+    vmm_put_frame(frame_addr);
+
+    // update the page entry
+    page_entry_add_attrib(e, SWAPPED);
+    page_entry_remove_attrib(e, PRESENT);
+    page_entry_set_swap_slot(e, disk_slot);
+    flush_page((uint32_t) vir_addr);
 }
 
 bool vmm_swap_out_page(void *vir_addr) {
@@ -206,69 +307,316 @@ bool vmm_swap_out_page(void *vir_addr) {
     if (disk_slot == DISK_NO_SLOT_AVAILABLE)
         return false;
 
-    //write the page to the disk
-    while (disk_write(disk_slot, (void *) get_frame_addr(*e), PAGE_SIZE) != PAGE_SIZE);
+    //write the page to the disk, through its mapping because the frame may not be identity mapped
+    void *page = (void *) ((uint32_t) vir_addr & ~(PAGE_SIZE - 1));
+    while (disk_write(disk_slot, page, PAGE_SIZE) != PAGE_SIZE);
     //todo handle if the write failed allot of times
 
-    // update the page entry
-    page_entry_add_attrib(e, SWAPPED);
-    page_entry_remove_attrib(e, PRESENT);
-    page_entry_set_frame(e, disk_slot);
-    flush_page((uint32_t) vir_addr);
-
+    vmm_page_swapped_out(e, vir_addr, disk_slot);
     return true;
 }
 
+/*
+ * Writes the pages to the run of slots at first_slot with a single disk write and points them to their slots.
+ * return true if the pages were swapped out, their slots are left to the caller otherwise
+ */
+static bool vmm_write_cluster(void *const *pages, size_t count, uint32_t first_slot) {
+    const uint32_t sectors_per_page = disk_sectors_per_page();
+    // The pages are gathered straight into the transfer buffer, the arena memory is never swapped out so
+    // the disk writes it without a bounce buffer
+    arena_t *scratch = arena_scratch();
+    const arena_scope_t scope = arena_begin(scratch);
+    uint8_t *buffer = arena_alloc(scratch, count * PAGE_SIZE);
+    bool written = false;
+    if (buffer != NULL) {
+        for (size_t i = 0; i < count; i++)
+            copy_page(buffer + i * PAGE_SIZE, pages[i]);
+        written = disk_write_direct(first_slot, buffer, count * PAGE_SIZE) == count * PAGE_SIZE;
+        if (written) {
+            for (size_t i = 0; i < count; i++)
+                vmm_page_swapped_out(vmm_get_page_entry(pages[i]), pages[i], first_slot + i * sectors_per_page);
+        }
+    }
+    arena_end(scratch, scope);
+    return written;
+}
+
+size_t vmm_swap_out_range(void *start, size_t count) {
+    if (count == 0 || count > VMM_SWAP_CLUSTER_PAGES)
+        return 0;
+    void *pages[VMM_SWAP_CLUSTER_PAGES];
+    for (size_t i = 0; i < count; i++) {
+        pages[i] = (void *) (((uint32_t) start & ~(PAGE_SIZE - 1)) + i * PAGE_SIZE);
+        const page_entry_t *e = vmm_find_page_entry(pages[i]);
+        if (is_page_table_addr(pages[i]) || e == NULL || !is_page_present(*e) || is_large_page(*e))
+            return 0;
+    }
+    const uint32_t first_slot = disk_alloc_slots(count * disk_sectors_per_page());
+    if (first_slot == DISK_NO_SLOT_AVAILABLE)
+        return 0;
+    if (!vmm_write_cluster(pages, count, first_slot)) {
+        disk_free_slots(first_slot, count * disk_sectors_per_page());
+        return 0;
+    }
+    return count;
+}
 
-bool vmm_swap_out_some_page() {
-    void *vir_addr = vmm_get_page_to_swap_out();
-    if (vir_addr == NULL)
-        return false;
-    return vmm_swap_out_page(vir_addr);
+size_t vmm_get_readahead_window() {
+    return readahead_window;
 }
 
+uint32_t vmm_get_swap_slot(void *vir_addr) {
+    const page_entry_t *e = vmm_find_page_entry(vir_addr);
+    return e != NULL && is_swapped(*e) ? get_swap_slot(*e) : DISK_NO_SLOT_AVAILABLE;
+}
+
+size_t vmm_swap_out_cluster(size_t max_pages) {
+    if (max_pages > VMM_SWAP_CLUSTER_PAGES)
+        max_pages = VMM_SWAP_CLUSTER_PAGES;
+
+    const size_t sector_size = disk_get_current_disk_logical_sector_size();
+    assert(PAGE_SIZE % sector_size == 0); // the pages lie one after the other in the run of slots
+    const uint32_t sectors_per_page = PAGE_SIZE / sector_size;
+
+    // The slots come first, so no more victims are chosen than the run holds - choosing a victim clears its
+    // accessed bit and moves the hand of the policy past it.
+    // A swap area that is too fragmented for the whole cluster may still have a run for part of it
+    size_t run_pages = max_pages;
+    uint32_t first_slot = DISK_NO_SLOT_AVAILABLE;
+    while (run_pages > 0 && (first_slot = disk_alloc_slots(run_pages * sectors_per_page)) == DISK_NO_SLOT_AVAILABLE)
+        run_pages /= 2;
+    if (run_pages == 0)
+        return 0;
+
+    // A page table is written on its own after the cluster, so the pages in it are already swapped out in
+    // the copy that goes to the disk
+    void *pages[VMM_SWAP_CLUSTER_PAGES];
+    void *page_table = NULL;
+    size_t count = 0;
+    while (count < run_pages && page_table == NULL) {
+        void *vir_addr = vmm_get_page_to_swap_out();
+        if (vir_addr == NULL)
+            break;
+        if (is_page_table_addr(vir_addr)) {
+            page_table = vir_addr;
+            continue;
+        }
+        void *page = (void *) ((uint32_t) vir_addr & ~(PAGE_SIZE - 1));
+        bool chosen = false; // the policy went around all its pages and got back to one it already chose
+        for (size_t i = 0; i < count && !chosen; i++)
+            chosen = pages[i] == page;
+        if (chosen)
+            break;
+        pages[count++] = page;
+    }
+
+    size_t swapped = count > 0 && vmm_write_cluster(pages, count, first_slot) ? count : 0;
+    // The slots the cluster didn't fill go back, all of them if the write failed
+    disk_free_slots(first_slot + swapped * sectors_per_page, (run_pages - swapped) * sectors_per_page);
 
+    if (page_table != NULL && vmm_swap_out_page(page_table))
+        swapped++;
+    return swapped;
+}
 
 /*
- * Swaps in a page from the disk
- * return true if the swap was successful, false otherwise
+ * Direct reclaim, for an allocation that found no free frame - kswapd didn't keep up.
+ * return true if a page was swapped out
  */
-bool vmm_swap_in_page(page_entry_t *e, const uint32_t vir_addr) {
-    physical_addr frame_addr = pmm_alloc_frame();
-    if (frame_addr == PMM_NO_FRAME_AVAILABLE) {
-        if (!vmm_swap_out_some_page())
-            return false;
-        frame_addr = pmm_alloc_frame();
-        if (frame_addr == PMM_NO_FRAME_AVAILABLE)
-            return false;
+bool vmm_swap_out_some_page() {
+    kswapd_count_direct_reclaim();
+    // The disk command costs more than the pages it writes, so reclaim writes a whole cluster at once
+    return vmm_swap_out_cluster(VMM_SWAP_CLUSTER_PAGES) > 0;
+}
+
+/*
+ * Allocates a frame for a page, reclaiming directly only if there is no free frame at all.
+ * When the allocation leaves memory low kswapd is woken to reclaim in the background.
+ * return the frame or PMM_NO_FRAME_AVAILABLE
+ */
+static physical_addr vmm_alloc_frame(bool zeroed) {
+    physical_addr frame_addr = zeroed ? pmm_alloc_zeroed_frame() : pmm_alloc_frame();
+    if (frame_addr == PMM_NO_FRAME_AVAILABLE && vmm_swap_out_some_page())
+        frame_addr = zeroed ? pmm_alloc_zeroed_frame() : pmm_alloc_frame();
+    if (paging_enabled && pmm_zone_is_low(ZONE_NORMAL))
+        kswapd_wake();
+    return frame_addr;
+}
+
+/*
+ * Maps the frame to the temp page and returns the flags to give to unmap_temp_page.
+ * The temp page is used by whoever got here first, an interrupt in the middle would overwrite it
+ */
+static uint32_t map_temp_page(physical_addr frame_addr) {
+    const uint32_t eflags = save_and_disable_interrupts();
+    page_entry_t *e = vmm_get_page_entry((void *) VMM_TEMP_PAGE_ADDR);
+    *e = frame_addr | PAGE_WRITEABLE | PRESENT;
+    flush_page(VMM_TEMP_PAGE_ADDR);
+    return eflags;
+}
+
+static void unmap_temp_page(uint32_t eflags) {
+    *vmm_get_page_entry((void *) VMM_TEMP_PAGE_ADDR) = 0;
+    flush_page(VMM_TEMP_PAGE_ADDR);
+    restore_interrupts(eflags);
+}
+
+void vmm_zero_frame(physical_addr frame_addr) {
+    if (!paging_enabled) {
+        zero_page((void *) frame_addr);
+        return;
     }
+    const uint32_t eflags = map_temp_page(frame_addr);
+    zero_page((void *) VMM_TEMP_PAGE_ADDR);
+    unmap_temp_page(eflags);
+}
 
+// Copies a page to a frame, the frame doesn't have to be mapped
+static void vmm_copy_to_frame(physical_addr frame_addr, const void *src) {
+    if (!paging_enabled) {
+        copy_page((void *) frame_addr, src);
+        return;
+    }
+    const uint32_t eflags = map_temp_page(frame_addr);
+    copy_page((void *) VMM_TEMP_PAGE_ADDR, src);
+    unmap_temp_page(eflags);
+}
 
+// Points the page entry to the frame the page was read to, it's present but not accessed yet
+static void vmm_page_swapped_in(page_entry_t *e, const uint32_t vir_addr, physical_addr frame_addr) {
     page_entry_set_frame(e, frame_addr);
-
-    const uint32_t disk_slot = get_frame_addr(*e);
-    while (disk_read(disk_slot, (void *) frame_addr, PAGE_SIZE) != PAGE_SIZE);
-    disk_free_slots_for_page(disk_slot);
-    // add the present attribute and remove the swapped attribute
     page_entry_add_attrib(e, PRESENT);
-    page_entry_remove_attrib(e, SWAPPED);
+    page_entry_remove_attrib(e, SWAPPED | ACCESSED);
+    frame_mapped(frame_addr);
+    flush_page(vir_addr);
+    page_replacement_page_in(frame_addr, (void *) vir_addr, true);
+}
+
+/*
+ * Grades the last read-ahead by how many of its pages were accessed since, and sizes the next one by it.
+ * Sampling of the replacement policy clears accessed bits too, so a hit may be missed but never made up
+ */
+static void vmm_readahead_adapt() {
+    if (readahead_pages == 0)
+        return;
+    size_t hits = 0;
+    for (size_t i = 0; i < readahead_pages; i++) {
+        const page_entry_t *e = vmm_find_page_entry((void *) (readahead_start + i * PAGE_SIZE));
+        if (e != NULL && is_page_present(*e) && (*e & ACCESSED))
+            hits++;
+    }
+    if (hits * 2 >= readahead_pages && readahead_window < VMM_SWAP_READAHEAD_MAX)
+        readahead_window *= 2;
+    else if (hits * 4 < readahead_pages && readahead_window > VMM_SWAP_READAHEAD_MIN)
+        readahead_window /= 2;
+    readahead_pages = 0;
+}
+
+/*
+ * Swaps in the page and up to max_pages - 1 pages after it in the same page table whose slots follow its slot
+ * on the disk, with a single disk read. The extra pages are read only while memory isn't low.
+ * return true if the page was swapped in, false otherwise
+ */
+static bool vmm_swap_in_pages(page_entry_t *e, const uint32_t vir_addr, size_t max_pages) {
+    const uint32_t page = vir_addr & ~(PAGE_SIZE - 1);
+    const uint32_t first_slot = get_swap_slot(*e);
+    const uint32_t sectors_per_page = disk_sectors_per_page();
+    if (max_pages > VMM_SWAP_READAHEAD_MAX)
+        max_pages = VMM_SWAP_READAHEAD_MAX;
+    if (max_pages > PAGE_TABLE_SIZE - get_table_index((void *) page))
+        max_pages = PAGE_TABLE_SIZE - get_table_index((void *) page);
+
+    physical_addr frames[VMM_SWAP_READAHEAD_MAX];
+    frames[0] = vmm_alloc_frame(false);
+    if (frames[0] == PMM_NO_FRAME_AVAILABLE)
+        return false;
+    size_t count = 1;
+    while (count < max_pages && is_swapped(e[count]) && get_swap_slot(e[count]) == first_slot + count * sectors_per_page
+           && !pmm_zone_is_low(ZONE_NORMAL)) {
+        frames[count] = pmm_alloc_frame();
+        if (frames[count] == PMM_NO_FRAME_AVAILABLE)
+            break;
+        count++;
+    }
+
+    // The frames may not be identity mapped, so the pages are read to a buffer and copied to them
+    arena_t *scratch = arena_scratch();
+    const arena_scope_t scope = arena_begin(scratch);
+    uint8_t *buffer = arena_alloc(scratch, count * PAGE_SIZE);
+    const bool read = buffer != NULL && disk_read(first_slot, buffer, count * PAGE_SIZE) == count * PAGE_SIZE;
+    if (read) {
+        for (size_t i = 0; i < count; i++) {
+            vmm_copy_to_frame(frames[i], buffer + i * PAGE_SIZE);
+            vmm_page_swapped_in(&e[i], page + i * PAGE_SIZE, frames[i]);
+        }
+        disk_free_slots(first_slot, count * sectors_per_page);
+    } else {
+        for (size_t i = 0; i < count; i++)
+            pmm_free_frame(frames[i]);
+    }
+    arena_end(scratch, scope);
+
+    if (read && count > 1) {
+        readahead_start = page + PAGE_SIZE;
+        readahead_pages = count - 1;
+    }
+    return read;
+}
+
+/*
+ * Swaps in a page from the disk
+ * return true if the swap was successful, false otherwise
+ */
+bool vmm_swap_in_page(page_entry_t *e, const uint32_t vir_addr) {
+    return vmm_swap_in_pages(e, vir_addr, 1);
+}
+
+/*
+ * Gives the page a private copy of its frame on the first write. The last vm context that shares the frame
+ * doesn't need a copy, the page just becomes writable again.
+ * return true if the page can be written, false if there was no frame for the copy
+ */
+static bool vmm_copy_on_write(page_entry_t *e, const uint32_t vir_addr) {
+    const physical_addr frame_addr = get_frame_addr(*e);
+    const pmm_frame_t *frame = pmm_frame_of(frame_addr);
+    if (frame == NULL || frame->refcount > 1) {
+        physical_addr copy_addr = pmm_alloc_frame();
+        if (copy_addr == PMM_NO_FRAME_AVAILABLE) {
+            if (!vmm_swap_out_some_page())
+                return false;
+            if (!is_page_present(*e))
+                return true; // the page itself was swapped out, the retry of the write swaps in a private copy
+            copy_addr = pmm_alloc_frame();
+            if (copy_addr == PMM_NO_FRAME_AVAILABLE)
+                return false;
+        }
+        if (pmm_zone_is_low(ZONE_NORMAL))
+            kswapd_wake();
+        vmm_copy_to_frame(copy_addr, (void *) (vir_addr & ~(PAGE_SIZE - 1)));
+        // the copy can be swapped out if the shared frame could
+        const bool swappable = page_replacement_is_tracked(frame_addr);
+        frame_unmapped(frame_addr);
+        vmm_put_frame(frame_addr);
+        frame_mapped(copy_addr);
+        page_entry_set_frame(e, copy_addr);
+        if (swappable)
+            page_replacement_page_in(copy_addr, (void *) (vir_addr & ~(PAGE_SIZE - 1)), false);
+    }
+    page_entry_remove_attrib(e, COW);
+    page_entry_add_attrib(e, PAGE_WRITEABLE);
     flush_page(vir_addr);
     return true;
 }
+
 /*
  * Allocates a new page and maps it to a frame, and doeesnt add it to the pages that can't be swapped.
  * return true if the allocation was successful, false otherwise
  */
 bool vmm_alloc_permanent_page(page_entry_t *e) {
-    //allocate physical frame
-    physical_addr frame_addr = pmm_alloc_frame();
-    if (frame_addr == PMM_NO_FRAME_AVAILABLE) {
-        if (!vmm_swap_out_some_page())
-            return false;
-        frame_addr = pmm_alloc_frame();
-        if (frame_addr == PMM_NO_FRAME_AVAILABLE)
-            return false;
-    }
+    //allocate physical frame, zeroed because it is either a page table or a demand zero page
+    const physical_addr frame_addr = vmm_alloc_frame(true);
+    if (frame_addr == PMM_NO_FRAME_AVAILABLE)
+        return false;
 
     //map the frame to the page entry
     page_entry_set_frame(e, frame_addr);
@@ -285,18 +633,14 @@ bool vmm_alloc_page(page_entry_t *e, void *vir_addr) {
     if (!vmm_alloc_permanent_page(e))
         return false;
 
-    if (!page_enqueue(vir_addr)) {
-        pmm_free_frame(get_frame_addr(*e));
-        page_entry_remove_attrib(e, PRESENT);
-        return false; // todo handle the error
-    }
-
+    page_replacement_page_in(get_frame_addr(*e), vir_addr, false);
     return true;
 }
 
 
 void vmm_free_page(page_entry_t *e) {
-    pmm_free_frame(*e & 0xFFFFF000);
+    frame_unmapped(get_frame_addr(*e));
+    vmm_put_frame(get_frame_addr(*e));
     *e = 0;
 }
 
@@ -309,6 +653,8 @@ void vmm_map_page(page_directory_t *page_dir, void *vir_addr, physical_addr phys
     const uint32_t pd_index = get_directory_index(vir_addr);
     const uint32_t pt_index = get_table_index(vir_addr);
     page_table_t *page_table;
+    if (is_large_page(page_dir->tables[pd_index]))
+        panic("Trying to map a 4KB page inside a 4MB page, pick one");
     if (is_page_present(page_dir->tables[pd_index])) // the table is exist and present
         page_table = (page_table_t *) get_page_table_addr(page_dir, pd_index);
 
@@ -330,20 +676,24 @@ void vmm_map_page(page_directory_t *page_dir, void *vir_addr, physical_addr phys
                                 (void *) get_page_table_vir_addr(page_dir, pd_index)))
                 panic("Failed to allocate a frame for the page table. We fucked up?");
         }
-        //needs to clear the page table
+        // the frame of the table is already zeroed
         page_entry_add_attrib(&page_dir->tables[pd_index], PAGE_WRITEABLE);
         page_table = (page_table_t *) get_page_table_addr(page_dir, pd_index);
         flush_page((uint32_t) page_table);
-        memset(page_table, 0, sizeof(page_table_t));
 
     }
 
     // map the page to the frame
     page_entry_t *page_entry = &page_table->entries[pt_index];
+    if (is_page_present(*page_entry))
+        frame_unmapped(get_frame_addr(*page_entry));
+    frame_mapped(phys_addr);
     page_entry_set_frame(page_entry, (uint32_t) phys_addr);
+    page_entry_remove_attrib(page_entry, COW);
     page_entry_add_attrib(page_entry, flags | PRESENT);
 
-    // todo add the flags to the table entry
+    // A table with user pages is a user table, it's copied and not shared when the vm context is copied
+    page_entry_add_attrib(&page_dir->tables[pd_index], flags & PAGE_USER);
 }
 
 void vmm_map_page_to_curr_dir(void *vir_addr, physical_addr frame_addr, uint32_t flags) {
@@ -354,15 +704,15 @@ void vmm_map_page_to_curr_dir(void *vir_addr, physical_addr frame_addr, uint32_t
 void vmm_unmap_page(void *vir_addr) {
     assert(current_directory != NULL);
     page_entry_t *e = vmm_get_page_entry(vir_addr);
-   	if(is_page_present(*e))
+    if (is_large_page(*e) && e == &current_directory->tables[get_directory_index(vir_addr)])
+        panic("Trying to unmap a page of the kernel identity mapping, the kernel still needs it");
+    if(is_page_present(*e))
     {
-    	pmm_free_frame(get_frame_addr(*e));
-    	*e = 0;
+        vmm_free_page(e);
     }
     else if(is_swapped(*e))
     {
-        const uint32_t disk_slot = get_frame_addr(*e);
-        disk_free_slots_for_page(disk_slot);
+        disk_put_slots_for_page(get_swap_slot(*e));
         *e = 0;
     }
     flush_page((uint32_t) vir_addr);
@@ -399,6 +749,10 @@ static page_entry_t *vmm_get_page_entry(void *vir_addr) {
     if (!is_page_present(current_directory->tables[pd_index])) // the page table is not present
         panic("Trying to access a page that is not present. how tf did we mange to get here?");
 
+    // A 4MB page has no page table, the directory entry is the entry of the page
+    if (is_large_page(current_directory->tables[pd_index]))
+        return &current_directory->tables[pd_index];
+
     page_table_t *page_table = (page_table_t *) get_page_table_addr(current_directory, pd_index);
     return &page_table->entries[pt_index];
 }
@@ -407,13 +761,15 @@ static page_entry_t *vmm_get_page_entry(void *vir_addr) {
 void page_fault_handler(uint32_t error_code) {
     uint32_t fault_addr;
     asm volatile("mov %%cr2, %0" : "=r"(fault_addr));
+    page_replacement_fault();
     page_entry_t *e = vmm_get_page_entry((void *) fault_addr);
     if (!is_page_present_error(error_code)) {
         // The page fault was caused by a page not present
         // fetch the page from disk if exits, else allocate a new frame
         // and map the page to the frame
-        if (is_swapped(*e)) { // the page is swapped so we need to swap it in
-            if (!vmm_swap_in_page(e, fault_addr))
+        if (is_swapped(*e)) { // the page is swapped so we need to swap it in, with the pages after it
+            vmm_readahead_adapt();
+            if (!vmm_swap_in_pages(e, fault_addr, readahead_window))
                 //todo Handle differently if its the user page(Probably make his life miserable)
                 panic("Failed to swap in page. dont know what to do so lets shut down the computer :)");
             return; // the iret in the page fault handler will refetch the instruction
@@ -421,33 +777,38 @@ void page_fault_handler(uint32_t error_code) {
             if (!vmm_alloc_page(e, (void *) fault_addr))
                 //todo Handle differently if its the user page(Probably throw an error that there is now memory)
                 panic("Failed to allocate a frame for the page. how tf did we mange to get here?");
+            // a demand zero page, the faulting access is allowed to write it
+            page_entry_add_attrib(e, PAGE_WRITEABLE | (is_page_user_error(error_code) ? PAGE_USER : 0));
             return;
         }
-    } else if (!is_cow(e)) {
-        //page present, if its copy on write, copy the page and map it to the new frame
-
+    } else if (is_page_write_error(error_code) && is_cow(*e)) {
+        // the page is shared with another vm context, copy it and map it to the new frame
+        if (!vmm_copy_on_write(e, fault_addr))
+            //todo Handle differently if its the user page
+            panic("Failed to copy a copy on write page, no frame left to copy it to");
+        return;
+    } else {
         //permission error, punish the user and panic if its the kernel beacsue I dont know how we got here
         if (!is_page_user_error(error_code))
             panic("Permission error in kernel mode. how tf did we mange to get here?");
         else
             //todo punish the user
             return;
-    } else
-        //todo implement the copy on write
-        return;
-
+    }
 }
 
 physical_addr vmm_calc_phys_addr(void *vir_addr) {
     page_entry_t *e = vmm_get_page_entry(vir_addr);
     if (!is_page_present(*e))
         panic("Trying to calculate the physical address of a page that is not present");
+    if (is_large_page(*e) && e == &current_directory->tables[get_directory_index(vir_addr)])
+        return get_large_frame_addr(*e) + ((uint32_t) vir_addr & (LARGE_PAGE_SIZE - 1));
     return get_frame_addr(*e) + get_frame_offset(vir_addr);
 }
 
 
 page_directory_t *vmm_create_empty_page_directory() {
-    page_directory_t *page_dir = (page_directory_t *) kmalloc(sizeof(page_directory_t));
+    page_directory_t *page_dir = (page_directory_t *) kmalloc_aligned(sizeof(page_directory_t), PAGE_SIZE);
     if (page_dir == NULL)
         return NULL;
 
@@ -455,102 +816,246 @@ page_directory_t *vmm_create_empty_page_directory() {
     return page_dir;
 }
 
-void vmm_destroy_page_directory(page_directory_t *page_dir) {
-  	//todo handle cow pages
+// Drops the references the entries of a page table hold on their frames and swap slots
+static void vmm_release_table_entries(page_table_t *page_table) {
+    for (size_t j = 0; j < PAGE_TABLE_SIZE; j++) {
+        if (is_page_present(page_table->entries[j]))
+            vmm_free_page(&page_table->entries[j]);
+        else if (is_swapped(page_table->entries[j]))
+            disk_put_slots_for_page(get_swap_slot(page_table->entries[j]));
+    }
+}
+
+/*
+ * Drops the references the directory holds on its page tables. A table that no other vm context shares
+ * is walked first and the pages it maps are released too, a swapped out table is read back to a buffer for it.
+ * The tables are read through the recursive mapping, so the directory must be the loaded one.
+ */
+static void vmm_release_page_tables(page_directory_t *page_dir) {
     for (size_t i = 0; i < TABLES_PER_DIR; i++) {
+        if (i == RECURSIVE_PAGE_TABLE_INDEX || is_large_page(page_dir->tables[i]))
+            continue; // the 4MB pages are the kernel identity mapping, it's not owned by the context
         if (is_page_present(page_dir->tables[i])) {
-            page_table_t *page_table = (page_table_t *) get_page_table_addr(page_dir, i);
-            for (size_t j = 0; j < PAGE_TABLE_SIZE; j++) {
-                if (is_page_present(page_table->entries[j]))
-                    pmm_free_frame(get_frame_addr(page_table->entries[j]));
-            }
-            pmm_free_frame(get_frame_addr(page_dir->tables[i]));
+            const physical_addr table_frame = get_frame_addr(page_dir->tables[i]);
+            const pmm_frame_t *table = pmm_frame_of(table_frame);
+            if (table != NULL && table->refcount == 1)
+                vmm_release_table_entries((page_table_t *) get_page_table_addr(page_dir, i));
+            vmm_put_frame(table_frame);
+        } else if (is_swapped(page_dir->tables[i])) {
+            // A swapped out table is private to its vm context, a fork gives the new one a copy in memory
+            const uint32_t table_slot = get_swap_slot(page_dir->tables[i]);
+            arena_t *scratch = arena_scratch();
+            const arena_scope_t scope = arena_begin(scratch);
+            page_table_t *page_table = arena_alloc(scratch, sizeof(page_table_t));
+            if (page_table != NULL && disk_read(table_slot, page_table, PAGE_SIZE) == PAGE_SIZE)
+                vmm_release_table_entries(page_table);
+            arena_end(scratch, scope);
+            disk_put_slots_for_page(table_slot);
         }
-        //todo handle cow pages
-        if (is_swapped(page_dir->tables[i])) {
-            const uint32_t disk_slot = get_frame_addr(page_dir->tables[i]);
-            disk_free_slots_for_page(disk_slot);
+        page_dir->tables[i] = 0;
+    }
+}
+
+/*
+ * Copies a user page table of the loaded directory for a new vm context. The writable pages become copy on
+ * write in both tables and every frame the copy maps gets another reference. A swapped out page stays swapped
+ * out, the copy shares its slot. A swapped out table stays swapped out too, it's read to a buffer and its copy
+ * on write marks are written back to its slot.
+ * return the frame of the copy or PMM_NO_FRAME_AVAILABLE if there is no memory (or the disk failed)
+ */
+static physical_addr vmm_copy_user_page_table(page_directory_t *page_dir, uint16_t pd_index) {
+    // The copy isn't mapped anywhere yet, it's built in a scratch buffer and copied to its frame at once
+    const physical_addr table_frame = vmm_alloc_frame(false);
+    if (table_frame == PMM_NO_FRAME_AVAILABLE)
+        return PMM_NO_FRAME_AVAILABLE;
+    arena_t *scratch = arena_scratch();
+    const arena_scope_t scope = arena_begin(scratch);
+    page_table_t *copy = arena_alloc(scratch, sizeof(page_table_t));
+    const bool table_swapped = is_swapped(page_dir->tables[pd_index]);
+    const uint32_t table_slot = get_swap_slot(page_dir->tables[pd_index]);
+    page_table_t *page_table = table_swapped ? arena_alloc(scratch, sizeof(page_table_t))
+                                             : (page_table_t *) get_page_table_vir_addr(page_dir, pd_index);
+    bool copied = copy != NULL && page_table != NULL;
+    if (copied && table_swapped)
+        copied = disk_read(table_slot, page_table, PAGE_SIZE) == PAGE_SIZE;
+
+    // The writable pages become copy on write first, a swapped out table that can't be written back is left as it was
+    bool marked = false;
+    for (size_t j = 0; j < PAGE_TABLE_SIZE && copied; j++) {
+        page_entry_t *e = &page_table->entries[j];
+        if (is_page_present(*e) && (*e & PAGE_WRITEABLE) && can_be_cow(get_frame_addr(*e))) {
+            page_entry_remove_attrib(e, PAGE_WRITEABLE);
+            page_entry_add_attrib(e, COW);
+            marked = true;
         }
     }
-    kfree(page_dir);
+    if (copied && table_swapped && marked)
+        copied = disk_write_direct(table_slot, page_table, PAGE_SIZE) == PAGE_SIZE;
+    if (!copied) {
+        arena_end(scratch, scope);
+        pmm_free_frame(table_frame);
+        return PMM_NO_FRAME_AVAILABLE;
+    }
+
+    for (size_t j = 0; j < PAGE_TABLE_SIZE; j++) {
+        const page_entry_t e = page_table->entries[j];
+        if (is_page_present(e)) {
+            pmm_frame_get(get_frame_addr(e));
+            frame_mapped(get_frame_addr(e));
+        } else if (is_swapped(e))
+            disk_get_slots_for_page(get_swap_slot(e));
+        copy->entries[j] = e;
+    }
+    vmm_copy_to_frame(table_frame, copy);
+    arena_end(scratch, scope);
+    return table_frame;
 }
 
 /*
     * Creates a new vm context - a new page directory
 *   This function should only be used after the paging is enabled
-*    copy the mapping of the page_directory to the new page directory (if null copy the kernel mapping)
+*    The kernel page tables are shared, the user ones are copied with their pages copy on write
 *
  */
-vm_context_t *vmm_create_vm_context(const page_directory_t *page_dir) {
-    //todo handle cow pages
+vm_context_t *vmm_create_vm_context(page_directory_t *page_dir) {
     vm_context_t *vm_context = (vm_context_t *) kmalloc(sizeof(vm_context_t));
     if (vm_context == NULL)
         return NULL;
 
     vm_context->page_dir = vmm_create_empty_page_directory();
-    // Copy the kernel mapping to the new page directory
-    //todo the not kernel mapping should be copied using copy on write
-    for (size_t i = 0; i < TABLES_PER_DIR - 1; i++)
-        vm_context->page_dir->tables[i] = page_dir->tables[i];
+    if (vm_context->page_dir == NULL) {
+        kfree(vm_context);
+        return NULL;
+    }
     // calc the physical address of the page directory using the kernel mapping beacuse
     // the page direcotry is saved in the kerenl space
     vm_context->page_dir_phys_addr = vmm_calc_phys_addr(vm_context->page_dir);
     // Map the recursive page table to point to the new page directory
-    vm_context->page_dir->tables[RECURSIVE_PAGE_TABLE_INDEX] = vm_context->page_dir_phys_addr | KERNEL_PAGE_FLAGS;
+    vm_context->page_dir->tables[RECURSIVE_PAGE_TABLE_INDEX] = vm_context->page_dir_phys_addr | RECURSIVE_PAGE_FLAGS;
+
+    // Load the directory for the copy, its user tables are only reachable through its recursive mapping
+    const physical_addr page_dir_phys_addr = vmm_calc_phys_addr(page_dir);
+    page_directory_t *prev_directory = current_directory;
+    const physical_addr prev_page_dir_addr = get_loaded_page_dir();
+    current_directory = page_dir;
+    load_page_dir(page_dir_phys_addr);
+    bool copied = true;
+    for (uint16_t i = 0; i < TABLES_PER_DIR - 1 && copied; i++) {
+        if (is_user_table(page_dir->tables[i])) {
+            const physical_addr table_frame = vmm_copy_user_page_table(page_dir, i);
+            copied = table_frame != PMM_NO_FRAME_AVAILABLE;
+            if (copied)
+                vm_context->page_dir->tables[i] = table_frame | (page_dir->tables[i] & 0xFFF);
+        } else {
+            // The kernel tables are shared, so every copied table gets another reference
+            vm_context->page_dir->tables[i] = page_dir->tables[i];
+            if (is_page_present(page_dir->tables[i]) && !is_large_page(page_dir->tables[i]))
+                pmm_frame_get(get_frame_addr(page_dir->tables[i]));
+        }
+    }
+    // Reloading the directory also flushes the writable translations of the pages that became copy on write
+    current_directory = prev_directory;
+    load_page_dir(prev_page_dir_addr);
+
+    if (!copied) {
+        vmm_destroy_vm_context(vm_context);
+        return NULL;
+    }
     return vm_context;
 }
 
 void vmm_destroy_vm_context(vm_context_t *vm_context) {
-    vmm_destroy_page_directory(vm_context->page_dir);
+    if (vm_context->page_dir == current_directory)
+        panic("Trying to destroy the vm context we are running on, sawing off the branch we sit on");
+
+    // Load the directory for a moment, its private tables are only reachable through its recursive mapping
+    page_directory_t *prev_directory = current_directory;
+    const physical_addr prev_page_dir_addr = get_loaded_page_dir();
+    current_directory = vm_context->page_dir;
+    load_page_dir(vm_context->page_dir_phys_addr);
+    vmm_release_page_tables(vm_context->page_dir);
+    current_directory = prev_directory;
+    load_page_dir(prev_page_dir_addr);
+
+    kfree(vm_context->page_dir);
     kfree(vm_context);
 }
 
 
+/*
+ * Identity maps [start, end) in the current directory. The 4MB aligned chunks are mapped with
+ * 4MB pages (one directory entry, no page table, one TLB entry) and the rest with 4KB pages.
+ * Only used by vmm_init, the 4MB pages are shared by every vm context and never unmapped.
+ */
+static void vmm_identity_map_range(physical_addr start, physical_addr end, uint32_t flags) {
+    physical_addr addr = start & ~(PAGE_SIZE - 1);
+    while (addr < end) {
+        page_entry_t *pde = &current_directory->tables[get_directory_index((void *) addr)];
+        if ((addr & (LARGE_PAGE_SIZE - 1)) == 0 && end - addr >= LARGE_PAGE_SIZE && !is_page_present(*pde)) {
+            *pde = addr | flags | PAGE_SIZE_BIT | PRESENT;
+            addr += LARGE_PAGE_SIZE;
+        } else {
+            vmm_map_page_to_curr_dir((void *) addr, addr, flags);
+            addr += PAGE_SIZE;
+        }
+    }
+}
+
+/*
+ * Creates the page tables of [start, end) in the current directory without mapping any page in them.
+ * The range can be mapped later on and every vm context that is copied from this directory shares it.
+ * Only used by vmm_init, before any vm context is copied.
+ */
+static void vmm_create_page_tables(uint32_t start, uint32_t end) {
+    for (uint32_t addr = start & ~(LARGE_PAGE_SIZE - 1); addr < end; addr += LARGE_PAGE_SIZE) {
+        page_entry_t *pde = &current_directory->tables[get_directory_index((void *) addr)];
+        if (is_page_present(*pde))
+            continue;
+        if (!vmm_alloc_permanent_page(pde))
+            panic("Failed to allocate a frame for a kernel page table. We fucked up?");
+        page_entry_add_attrib(pde, PAGE_WRITEABLE);
+    }
+}
+
 void vmm_init() {
     current_directory = &kernel_directory;
 
     // Initialize the page directory entries.
     // Each entry is set to 0x00000002: Supervisor, Read/Write, Not Present.
     for (size_t i = 0; i < TABLES_PER_DIR; i++)
-        page_entry_add_attrib(current_directory->tables + i, KERNEL_PAGE_FLAGS); //
+        page_entry_add_attrib(current_directory->tables + i, PAGE_WRITEABLE);
 
 
-    extern char _kernel_start, _kernel_end;
     extern const unsigned int _kernel_stack_top, _kernel_stack_pages_amount;
-    size_t kernel_size = (size_t) (&_kernel_end - &_kernel_start);
-    //Create frame for the kernel and map them to the lower half memory(identity mapping)
+    // The low memory - the BIOS area, the VGA buffer, the kernel image, the PMM metadata after it and the
+    // DMA zone - is identity mapped. It is rounded to 4MB so it is mapped with large pages only.
     // This is done so it would be easy to copy for new page directories the kernel mapping because
     // we dont want to swap in the kernel mapping
-    size_t kernel_frames = (kernel_size + PAGE_SIZE - 1) / PAGE_SIZE;
-
     // the allocation of the frames in pmm is done in the pmm_init function
     // todo give the wrtie permission only to the data section
-    for (size_t i = 0; i < kernel_frames; i++) {
-        void *addr = (void *) (&_kernel_start + i * PAGE_SIZE);
-        vmm_map_page_to_curr_dir(addr, (physical_addr) addr, KERNEL_PAGE_FLAGS);
-    }
+    const pmm_zone_stats_t dma_zone = pmm_get_zone_stats(ZONE_DMA);
+    physical_addr low_memory_end = (dma_zone.first_frame + dma_zone.frames) * PAGE_SIZE;
+    if (pmm_get_kernel_reserved_end() > low_memory_end)
+        low_memory_end = pmm_get_kernel_reserved_end();
+    vmm_identity_map_range(0, ALIGN_TO_LARGE_PAGE(low_memory_end), KERNEL_PAGE_FLAGS);
 
-    // Map the Recursive page_table to point to the page directory
-    current_directory->tables[RECURSIVE_PAGE_TABLE_INDEX] = (physical_addr) current_directory | KERNEL_PAGE_FLAGS;
+    // Map the Recursive page_table to point to the page directory.
+    // Not global, the tables it shows are different in every vm context
+    current_directory->tables[RECURSIVE_PAGE_TABLE_INDEX] = (physical_addr) current_directory | RECURSIVE_PAGE_FLAGS;
 
     // map Kernel stack
-    for (size_t i = 0; i < _kernel_stack_pages_amount; i++) {
-        void *addr = (void *) (_kernel_stack_top - i * PAGE_SIZE);
-        vmm_map_page_to_curr_dir(addr, (physical_addr) addr, KERNEL_PAGE_FLAGS);
-    }
+    const physical_addr stack_end = ALIGN_TO_PAGE((physical_addr) _kernel_stack_top);
+    vmm_identity_map_range(stack_end - _kernel_stack_pages_amount * PAGE_SIZE, stack_end, KERNEL_PAGE_FLAGS);
 
-    //Map heap address
-    KERNEL_BASE_HEAP_ADDR = ALIGN_TO_PAGE((uint32_t) _kernel_stack_top);
-    size_t num_pages = KERNEL_HEAP_SIZE / PAGE_SIZE;
-    for (size_t i = 0; i < num_pages; i++) {
-        void *addr = (void *) (KERNEL_BASE_HEAP_ADDR + i * PAGE_SIZE);
-        vmm_map_page_to_curr_dir(addr, (physical_addr) addr, KERNEL_PAGE_FLAGS);
-    }
+    // The heap pages are mapped by kmalloc when it needs them, only the page tables are created here
+    vmm_create_page_tables(KERNEL_BASE_HEAP_ADDR, KERNEL_BASE_HEAP_ADDR + KERNEL_HEAP_SIZE);
+    vmm_create_page_tables(KERNEL_LARGE_HEAP_ADDR, KERNEL_LARGE_HEAP_ADDR + KERNEL_LARGE_HEAP_SIZE);
 
-    //Map the VGA buffer
-    vmm_map_page_to_curr_dir((void *) VGA_ADDRESS, (physical_addr) VGA_ADDRESS, PRESENT | PAGE_WRITEABLE);
+    // Create the page table of the temp page, the page itself is mapped only while it is used
+    vmm_create_page_tables(VMM_TEMP_PAGE_ADDR, VMM_TEMP_PAGE_ADDR + PAGE_SIZE);
 
     // load the physical address of the kernel page directory
+    enable_large_and_global_pages();
     load_page_dir((physical_addr) &kernel_directory);
     enable_paging();
 }
\ No newline at end of file
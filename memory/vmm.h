@@ -27,7 +27,8 @@
  * BIT 7: Page Size - 1 if page size bit. Page is 4MB 0 if 4KB(defualt is 4KB)
  * BIT 8: Global - 1 if global page. TLB entries are not invalidated on CR3 writes
  * BIT 9: Swapped - 1 if page is swapped 0 if not. if the page
- * BIT 10-11: Available for use.
+ * BIT 10: Copy on write - 1 if the page is read-only only until the first write copies it
+ * BIT 11: Available for use.
  * BIT 12-31: Page Table Base Address - 20 bits. if swapped the address of the slot address
  */
 typedef uint32_t page_entry_t;
@@ -60,13 +61,23 @@ typedef struct{
 #define PAGE_SIZE_BIT 0x80 // page size bit. Page is 4MB
 #define GLOBAL 0x100 // global page. TLB entries are not invalidated on CR3 writes
 #define SWAPPED 0x200 // page is swapped
+#define COW 0x400 // page is shared read-only with another vm context, the first write gets a private copy
 #define EMPTY_USER_PAGE_DIR_FLAGS (PAGE_WRITEABLE | PAGE_USER)
 #define KERNEL_PAGE_FLAGS (PAGE_WRITEABLE | PRESENT | GLOBAL)
+#define RECURSIVE_PAGE_FLAGS (PAGE_WRITEABLE | PRESENT)
 
 
 #define ALIGN_TO_PAGE(addr) ((addr + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1))
+#define LARGE_PAGE_SIZE 0x400000u // 4MB, a page directory entry with PAGE_SIZE_BIT maps it directly
+#define ALIGN_TO_LARGE_PAGE(addr) ((addr + LARGE_PAGE_SIZE - 1) & ~(LARGE_PAGE_SIZE - 1))
 
 #define RECURSIVE_PAGE_TABLE_INDEX 1023
+#define VMM_SWAP_CLUSTER_PAGES 16u // Pages reclaim swaps out with a single disk write
+#define VMM_SWAP_READAHEAD_MIN 2u  // Bounds of the pages a swap in fault reads with a single disk read
+#define VMM_SWAP_READAHEAD_MAX VMM_SWAP_CLUSTER_PAGES
+// A kernel page that frames are mapped to for a moment, e.g. to zero them. Its page table is created by
+// vmm_init so every vm context shares it
+#define VMM_TEMP_PAGE_ADDR (((uint32_t) RECURSIVE_PAGE_TABLE_INDEX << 22) - PAGE_SIZE)
 
 
 void vmm_init();
@@ -74,12 +85,50 @@ void vmm_switch_vm_context(const vm_context_t *vm_context);
 
 physical_addr vmm_calc_phys_addr(void *vir_addr);
 
-vm_context_t *vmm_create_vm_context(const page_directory_t *page_dir);
+/*
+ * Creates a vm context that is a copy of the page directory. The kernel page tables are shared, the user
+ * ones are duplicated and their writable pages become read-only copy on write pages in both contexts.
+ * return the new vm context or NULL if there is no memory for it
+ */
+vm_context_t *vmm_create_vm_context(page_directory_t *page_dir);
 
 void vmm_destroy_vm_context(vm_context_t *vm_context);
 void page_fault_handler(uint32_t error_code);
 void vmm_map_page(page_directory_t *page_dir, void *vir_addr, physical_addr frame_addr, uint32_t flags);
 void vmm_map_page_to_curr_dir(void *vir_addr, physical_addr frame_addr, uint32_t flags);
 void vmm_unmap_page(void *vir_addr);
+
+// The accessed state of a page the replacement policy tracks, see vmm_page_test_and_clear_accessed
+typedef enum {
+    PAGE_NOT_EVICTABLE, // Not mapped to the frame in this vm context, or shared so evicting it frees nothing
+    PAGE_IDLE,          // Not accessed since the last check
+    PAGE_ACCESSED,      // Accessed since the last check, the bit was cleared
+} page_access_t;
+
+// Reads and clears the accessed bit of the page the frame holds (see page_replacement.h) in the current vm context
+page_access_t vmm_page_test_and_clear_accessed(physical_addr frame_addr);
+
+/*
+ * Swaps out up to max_pages (at most VMM_SWAP_CLUSTER_PAGES) pages the replacement policy chooses. The pages
+ * are gathered and written to a contiguous run of swap slots with a single disk write.
+ * return the amount of pages swapped out
+ */
+size_t vmm_swap_out_cluster(size_t max_pages);
+
+/*
+ * Swaps out count adjacent resident pages from start (at most VMM_SWAP_CLUSTER_PAGES) to a contiguous run of
+ * swap slots with a single disk write, e.g. a buffer that won't be used for a while.
+ * return the amount of pages swapped out, 0 if one of them isn't resident or there is no run of slots
+ */
+size_t vmm_swap_out_range(void *start, size_t count);
+
+// Returns the amount of pages the next swap in fault reads, it grows while the read-ahead pages get used
+size_t vmm_get_readahead_window();
+
+// Returns the swap slot of a swapped out page of the current vm context, DISK_NO_SLOT_AVAILABLE if it isn't swapped out
+uint32_t vmm_get_swap_slot(void *vir_addr);
+
+// Fills a frame with zeros, the frame doesn't have to be mapped
+void vmm_zero_frame(physical_addr frame_addr);
 page_directory_t *vmm_get_kernel_page_directory();
 #endif // VMM_H
@@ -2,7 +2,7 @@
 section .multiboot_header
 align 4
     dd 0x1BADB002          ; Multiboot magic number
-    dd 0x0                 ; Multiboot flags
-    dd -(0x1BADB002 + 0x0) ; Multiboot checksum
+    dd 0x3                 ; Multiboot flags - page aligned modules and memory information (the memory map)
+    dd -(0x1BADB002 + 0x3) ; Multiboot checksum
 
 
@@ -0,0 +1,45 @@
+//
+// Created by Yoav on 10/18/2026.
+//
+
+/*
+ * The parts of the multiboot (version 1) specification the kernel uses.
+ * The header itself is in multiboot.asm, start.asm passes the magic and the info pointer to kernel_main.
+ */
+
+#ifndef MYKERNEL_MULTIBOOT_H
+#define MYKERNEL_MULTIBOOT_H
+
+#include "std/stdint.h"
+
+#define MULTIBOOT_BOOTLOADER_MAGIC 0x2BADB002 // The value in eax when the bootloader jumps to the kernel
+
+// multiboot_info_t flags
+#define MULTIBOOT_INFO_MEMORY 0x1   // mem_lower and mem_upper are valid
+#define MULTIBOOT_INFO_CMDLINE 0x4  // cmdline is valid
+#define MULTIBOOT_INFO_MEM_MAP 0x40 // mmap_length and mmap_addr are valid
+
+// multiboot_mmap_entry_t types
+#define MULTIBOOT_MEMORY_AVAILABLE 1 // Usable RAM, every other type is reserved
+
+typedef struct {
+    uint32_t flags;
+    uint32_t mem_lower;   // KB of memory starting at 0
+    uint32_t mem_upper;   // KB of memory starting at 1MB
+    uint32_t boot_device;
+    uint32_t cmdline;     // Physical address of the kernel command line, a null terminated string
+    uint32_t mods_count;
+    uint32_t mods_addr;
+    uint32_t syms[4];
+    uint32_t mmap_length; // Size in bytes of the memory map buffer
+    uint32_t mmap_addr;   // Physical address of the first multiboot_mmap_entry_t
+} __attribute__((packed)) multiboot_info_t;
+
+typedef struct {
+    uint32_t size;        // Size of the entry without this field, the next entry is at (addr + size + 4)
+    uint64_t addr;
+    uint64_t len;
+    uint32_t type;
+} __attribute__((packed)) multiboot_mmap_entry_t;
+
+#endif //MYKERNEL_MULTIBOOT_H
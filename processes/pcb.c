@@ -8,6 +8,17 @@
 #include "../memory/vmm.h"
 #include "../errors.h"
 
+static kmem_cache_t *context_cache = NULL;
+static kmem_cache_t *pcb_cache = NULL;
+
+void pcb_init() {
+    // The context is read on every context switch, so it gets a cache line of its own
+    context_cache = kmem_cache_create("context_t", sizeof(context_t), KMALLOC_CACHE_LINE, NULL);
+    pcb_cache = kmem_cache_create("pcb_t", sizeof(pcb_t), 0, NULL);
+    if (context_cache == NULL || pcb_cache == NULL)
+        panic("Failed to create the pcb caches, no processes for you");
+}
+
 void pcb_print(pcb_t *pcb) {
     if(pcb == NULL)
         panic("Trying to print a NULL pcb, what the hell are you doing?\n Closing the computer as punishment");
@@ -16,7 +27,7 @@ void pcb_print(pcb_t *pcb) {
     printf("PCB state: %d\n", pcb->state);
 }
 context_t *context_create(uint32_t eip, uint32_t esp) {
-    context_t *context = kmalloc(sizeof(context_t));
+    context_t *context = kmem_cache_alloc(context_cache);
     if(context == NULL)
         return NULL;
     context->edi = 0;
@@ -33,18 +44,23 @@ context_t *context_create(uint32_t eip, uint32_t esp) {
 }
 
 void context_destroy(context_t *context) {
-    kfree(context);
+    kmem_cache_free(context_cache, context);
 }
 
 pcb_t *pcb_create(uint32_t eip, uint32_t esp, vm_context_t *vm_context_parent) {
   	if(vm_context_parent == NULL)
         return NULL;
 
-    pcb_t *pcb = kmalloc(sizeof(pcb_t));
+    pcb_t *pcb = kmem_cache_alloc(pcb_cache);
     if(pcb == NULL)
         return NULL;
     pcb->context = context_create(eip, esp);
     pcb->vm_context = vmm_create_vm_context(vm_context_parent->page_dir);
+    if(pcb->vm_context == NULL) {
+        context_destroy(pcb->context);
+        kmem_cache_free(pcb_cache, pcb);
+        return NULL;
+    }
     pcb->state = READY;
     return pcb;
 }
@@ -53,7 +69,7 @@ void pcb_destroy(pcb_t *pcb) {
     if(pcb == NULL) return;
     context_destroy(pcb->context);
     vmm_destroy_vm_context(pcb->vm_context);
-    kfree(pcb);
+    kmem_cache_free(pcb_cache, pcb);
 }
 
 /*
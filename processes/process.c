@@ -15,6 +15,8 @@
 
 #define PROCESS_NAME_MAX_LENGTH 32
 
+static kmem_cache_t *process_cache = NULL;
+
 void process_print(process_t *process) {
     if(process == NULL)
         panic("Trying to print a NULL process, what the hell are you doing?");
@@ -30,7 +32,7 @@ void process_destroy(process_t *process) {
           return;
   	pcb_destroy(process->pcb);
   	pid_free(process->pid);
-  	kfree(process);
+  	kmem_cache_free(process_cache, process);
 }
 
 void process_create_stack(process_t *process, uint32_t stack_size)
@@ -49,9 +51,9 @@ void process_create_stack(process_t *process, uint32_t stack_size)
     vmm_switch_vm_context(process->pcb->vm_context);
 
     for (uint32_t i = 0; i < pages; ++i) {
-        physical_addr pa = pmm_alloc_frame();
+        physical_addr pa = pmm_alloc_zeroed_frame();
         if (pa == PMM_NO_FRAME_AVAILABLE)
-            panic("pmm_alloc_frame() failed while building stack");
+            panic("pmm_alloc_zeroed_frame() failed while building stack");
 
         uint32_t vir_addr = esp_top - (i + 1) * PAGE_SIZE;
 
@@ -60,9 +62,6 @@ void process_create_stack(process_t *process, uint32_t stack_size)
                                   EMPTY_USER_PAGE_DIR_FLAGS);
         // Invalidate TLB for this page
         asm volatile ("invlpg (%0)" :: "r"(vir_addr) : "memory");
-
-        // Zero the newly mapped page in-place
-        memset((void *)vir_addr, 0, PAGE_SIZE);
     }
 
     // Build the initial trap frame at the top of the stack
@@ -87,12 +86,12 @@ process_t *process_create(void (*entry_point)(), char *name, priority_t priority
     if(parent == NULL)
 		return NULL;
 	//todo maybe add more sainty checks
-	process_t *process = kmalloc(sizeof(process_t));
+	process_t *process = kmem_cache_alloc(process_cache);
 	if(process == NULL)
         return NULL;
   	process->pcb = pcb_create((uint32_t)entry_point, 100000000, parent->pcb->vm_context);
     if(process->pcb == NULL){
-    	kfree(process);
+    	kmem_cache_free(process_cache, process);
         return NULL;
     }
     process_create_stack(process, 0x1000 * 5);
@@ -105,8 +104,13 @@ process_t *process_create(void (*entry_point)(), char *name, priority_t priority
 
 
 void processes_init() {
+    pcb_init();
+    process_cache = kmem_cache_create("process_t", sizeof(process_t), 0, NULL);
+    if (process_cache == NULL)
+        panic("Failed to create the process cache, no processes for you");
+
 	// Map the running kernel process to the current process
-    process_t *proc = kmalloc(sizeof(process_t));
+    process_t *proc = kmem_cache_alloc(process_cache);
     if(proc == NULL)
 		panic("Failed to allocate memory for the current process");
     vm_context_t *vm_context = kmalloc(sizeof(vm_context_t));
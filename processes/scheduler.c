@@ -26,10 +26,11 @@ typedef struct {
 
 static process_queue_t ready_queue = {NULL, NULL, 0};
 static process_queue_node_t *current_process_node = NULL;
+static kmem_cache_t *queue_node_cache = NULL;
 process_t *current_process = NULL;
 
 static process_queue_node_t *scheduler_create_queue_node(process_t *process) {
-    process_queue_node_t *node = (process_queue_node_t *) kmalloc(sizeof(process_queue_node_t));
+    process_queue_node_t *node = (process_queue_node_t *) kmem_cache_alloc(queue_node_cache);
     if (node == NULL)
         panic("Failed to allocate memory for process queue node");
 
@@ -40,7 +41,7 @@ static process_queue_node_t *scheduler_create_queue_node(process_t *process) {
 }
 
 static inline void scheduler_destroy_queue_node(process_queue_node_t *node) {
-    kfree(node);
+    kmem_cache_free(queue_node_cache, node);
 }
 
 void scheduler_add_process(process_t *process) {
@@ -145,6 +146,10 @@ void scheduler_init(process_t *init_process) {
     if (init_process == NULL)
         panic("Tried to initialize the scheduler with a NULL process, you sneaky bastard (probably a bug in the kernel)");
 
+    queue_node_cache = kmem_cache_create("process_queue_node_t", sizeof(process_queue_node_t), 0, NULL);
+    if (queue_node_cache == NULL)
+        panic("Failed to create the process queue node cache");
+
     tick_count = 0;
     scheduler_add_process(init_process);
     current_process = init_process;
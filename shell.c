@@ -7,6 +7,9 @@
 #include "drivers/keyboard.h"
 #include "std/string.h"
 #include "std/stdlib.h"
+#include "memory/kmalloc.h"
+#include "memory/page_replacement.h"
+#include "memory/kswapd.h"
 // Main shell function
 void shell() {
     char input[MAX_INPUT_LENGTH]; // Buffer for user input
@@ -67,6 +70,8 @@ void execute_command(const char *input) {
         put_string("  color [num]   - Changes the text color\n");
         put_string("  scroll        - Scrolls the screen\n");
         put_string("  clearrow [n]  - Clears a specific row (0-24)\n");
+        put_string("  heapprof      - Shows the kmalloc call sites that hold memory\n");
+        put_string("  vmstat        - Shows the page faults of every page replacement policy and the reclaim stats\n");
         put_string("  exit          - Exits the shell\n");
     } else if (!strcmp(input, "clear")) {
         clear_screen();
@@ -95,6 +100,13 @@ void execute_command(const char *input) {
             put_int(VGA_HEIGHT - 1);
             put_string(".\n");
         }
+    } else if (!strcmp(input, "heapprof")) {
+        put_string("\n");
+        kmalloc_profile_dump();
+    } else if (!strcmp(input, "vmstat")) {
+        put_string("\n");
+        page_replacement_dump();
+        kswapd_dump();
     } else if (!strcmp(input, "exit")) {
         put_string("\nExiting Enhanced Shell. Goodbye!\n");
         while (1) {
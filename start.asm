@@ -12,5 +12,7 @@ _kernel_stack_pages_amount dd 100
 start:
     cli                          ; Clear interrupts
     mov esp, [_kernel_stack_top] ; Now loads 0x3FFFFFF directly into ESP
+    push ebx                     ; multiboot info pointer - second argument of kernel_main
+    push eax                     ; multiboot magic - first argument of kernel_main
     call kernel_main             ; Jump to kernel main function
     hlt                          ; Halt CPU
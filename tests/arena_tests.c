@@ -0,0 +1,71 @@
+// tests/arena_tests.c
+#include "../memory/arena.h"
+#include "../memory/pmm.h"
+#include "test_framework.h"
+#include "arena_tests.h"
+
+#define ARENA_CHUNK_BYTES ((size_t) PMM_BLOCK_SIZE << ARENA_CHUNK_ORDER)
+
+TEST(test_arena_scope_frees_all) {
+    arena_t arena;
+    arena_init(&arena);
+    const size_t free_before = pmm_get_free_frames_count();
+
+    arena_scope_t scope = arena_begin(&arena);
+    uint8_t *a = arena_alloc(&arena, 10);
+    uint8_t *b = arena_alloc(&arena, 100);
+    CHECK_NE(a, NULL, "first allocation");
+    CHECK_NE(b, NULL, "second allocation");
+    CHECK_EQ((uint32_t) a % ARENA_ALIGN, 0, "allocations are aligned");
+    CHECK_EQ(b - a, 16, "allocations are bumped one after the other");
+    arena_end(&arena, scope);
+
+    scope = arena_begin(&arena);
+    CHECK_EQ(arena_alloc(&arena, 10), a, "the next scope starts where the ended one did");
+    arena_end(&arena, scope);
+
+    CHECK_EQ(arena_trim(&arena), 1u << ARENA_CHUNK_ORDER, "trim gives the chunk back");
+    CHECK_EQ(pmm_get_free_frames_count(), free_before, "no frames are left behind");
+}
+
+TEST(test_arena_nested_scopes) {
+    arena_t arena;
+    arena_init(&arena);
+    const arena_scope_t outer = arena_begin(&arena);
+    uint8_t *kept = arena_alloc(&arena, 64);
+    kept[0] = 0xAB;
+
+    const arena_scope_t inner = arena_begin(&arena);
+    // Bigger than a chunk, so the inner scope starts chunks of its own
+    uint8_t *big = arena_alloc(&arena, ARENA_CHUNK_BYTES + PMM_BLOCK_SIZE);
+    uint8_t *small = arena_alloc(&arena, ARENA_CHUNK_BYTES / 2);
+    CHECK_NE(big, NULL, "allocation bigger than a chunk");
+    CHECK_NE(small, NULL, "allocation after it");
+    big[ARENA_CHUNK_BYTES] = 1;
+    arena_end(&arena, inner);
+
+    CHECK_EQ(kept[0], 0xAB, "the outer scope keeps its memory");
+    CHECK_EQ(arena_alloc(&arena, 64), kept + 64, "the outer scope continues after the inner one ended");
+    arena_end(&arena, outer);
+    CHECK(arena_trim(&arena) > 1u << ARENA_CHUNK_ORDER, "every chunk is given back");
+}
+
+TEST(test_arena_memory_is_dma) {
+    arena_t *scratch = arena_scratch();
+    const arena_scope_t scope = arena_begin(scratch);
+    void *buffer = arena_alloc(scratch, PMM_BLOCK_SIZE);
+    CHECK_NE(buffer, NULL, "scratch allocation");
+    CHECK((uint32_t) buffer < PMM_DMA_ZONE_END, "the scratch arena uses the DMA zone");
+    arena_end(scratch, scope);
+}
+
+// ---------- Main ----------
+void run_arena_tests(void) {
+    const test_suite_t suite = begin_suite("ARENA");
+
+    RUN(test_arena_scope_frees_all);
+    RUN(test_arena_nested_scopes);
+    RUN(test_arena_memory_is_dma);
+
+    end_suite(&suite);
+}
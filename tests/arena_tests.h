@@ -0,0 +1,9 @@
+//
+// Created by Yoav on 10/18/2026.
+//
+
+#ifndef MYKERNEL_ARENA_TESTS_H
+#define MYKERNEL_ARENA_TESTS_H
+
+void run_arena_tests();
+#endif //MYKERNEL_ARENA_TESTS_H
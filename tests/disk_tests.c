@@ -5,82 +5,8 @@
 #include "../std/stdint.h"
 #include "../memory/kmalloc.h"
 #include "../memory/utills.h"
-
-// ---------- Minimal COM1 serial (mirrors logs to CLI via -serial stdio) ----------
-static inline void outb(uint16_t port, uint8_t val) { __asm__ volatile ("outb %0, %1" : : "a"(val), "Nd"(port)); }
-
-static inline uint8_t inb(uint16_t port) {
-    uint8_t r;
-    __asm__ volatile("inb %1, %0" : "=a"(r) : "Nd"(port));
-    return r;
-}
-
-#define COM1 0x3F8
-
-static void serial_init(void) {
-    outb(COM1 + 1, 0x00); // disable interrupts
-    outb(COM1 + 3, 0x80); // DLAB on
-    outb(COM1 + 0, 0x03); // 38400 baud divisor (lo)
-    outb(COM1 + 1, 0x00); // (hi)
-    outb(COM1 + 3, 0x03); // 8N1
-    outb(COM1 + 2, 0xC7); // FIFO enable/clear, 14-byte threshold
-    outb(COM1 + 4, 0x0B); // IRQs enabled, RTS/DSR set
-}
-
-static int serial_tx_empty(void) { return (inb(COM1 + 5) & 0x20) != 0; }
-
-static void serial_putc(char c) {
-    while (!serial_tx_empty()) {
-    }
-    outb(COM1, (uint8_t) c);
-}
-
-static void serial_puts(const char *s) {
-    while (*s) {
-        if (*s == '\n') serial_putc('\r');
-        serial_putc(*s++);
-    }
-}
-
-// QEMU exits with (code<<1)|1. We'll use 0x10 for PASS => exit 33; 0x11 for FAIL => exit 35.
-static inline void qemu_exit_code(uint8_t code) {
-    __asm__ volatile ("outb %0, %1" : : "a"(code), "Nd"(0xF4));
-    for (;;) { __asm__ volatile("hlt"); }
-}
-
-static inline void qemu_exit_pass(void) { qemu_exit_code(0x10); }
-static inline void qemu_exit_fail(void) { qemu_exit_code(0x11); }
-
-// ---------- Tiny test framework ----------
-static int g_failures = 0;
-static int g_tests_run = 0;
-
-#define TEST(name) static void name(void)
-#define RUN(testfn) do { \
-    const char* tn = #testfn; \
-    printf("[ RUN ] %s\n", tn); serial_puts("[ RUN ] "); serial_puts(tn); serial_puts("\n"); \
-    g_tests_run++; testfn(); \
-} while(0)
-
-#define CHECK(cond, msg) do { \
-    if (!(cond)) { \
-        printf("[FAIL] %s\n", msg); serial_puts("[FAIL] "); \
-        serial_puts(msg); serial_puts("\n"); g_failures++; \
-    } \
-    else { \
-        printf("[PASS] %s\n", msg); serial_puts("[PASS] "); \
-        serial_puts(msg); serial_puts("\n"); \
-    } \
-} while (0)
-
-#define CHECK_EQ(a,b,msg)   CHECK((a)==(b), msg)
-#define CHECK_NE(a,b,msg)   CHECK((a)!=(b), msg)
-#define CHECK_MEMEQ(a,b,n,msg) do { \
-    if (memcmp((a),(b),(n))!=0) { \
-        printf("[FAIL] %s\n", msg); serial_puts("[FAIL] "); serial_puts(msg); serial_puts("\n"); g_failures++; } \
-    else { \
-        printf("[PASS] %s\n", msg); serial_puts("[PASS] "); serial_puts(msg); serial_puts("\n"); } \
-    } while(0)
+#include "test_framework.h"
+#include "disk_tests.h"
 
 static inline void fill_pattern(uint8_t *buf, size_t n, uint32_t seed) {
     uint32_t x = seed;
@@ -90,7 +16,9 @@ static inline void fill_pattern(uint8_t *buf, size_t n, uint32_t seed) {
     }
 }
 
-#define LBA_BASE  4096U   // keep clear of boot sectors
+// The raw reads and writes go to sectors taken from the swap area, so they can't hit a swapped out page
+#define LBA_SPAN 128U
+static uint32_t lba_base = DISK_NO_SLOT_AVAILABLE;
 
 // ---------- Tests (kept small – safe for stack bounce buffers) ----------
 
@@ -102,7 +30,7 @@ TEST(test_disk_basic_info) {
 
 TEST(test_ata_read_write_small_counts) {
     const size_t sec = disk_get_current_disk_logical_sector_size();
-    const uint32_t lbs[] = {LBA_BASE + 10, LBA_BASE + 100, LBA_BASE + 200};
+    const uint32_t lbs[] = {lba_base + 10, lba_base + 20, lba_base + 30};
     const uint16_t counts[] = {1, 2, 4};
     for (int i = 0; i < 3; i++) {
         const uint32_t lba = lbs[i];
@@ -120,13 +48,13 @@ TEST(test_ata_read_write_small_counts) {
 
 TEST(test_disk_zero_length_rw) {
     uint8_t tmp = 0x5A;
-    CHECK_EQ(disk_write(LBA_BASE+700, &tmp, 0), 0, "disk_write len=0 returns 0");
-    CHECK_EQ(disk_read (LBA_BASE+700, &tmp, 0), 0, "disk_read  len=0 returns 0");
+    CHECK_EQ(disk_write(lba_base+40, &tmp, 0), 0, "disk_write len=0 returns 0");
+    CHECK_EQ(disk_read (lba_base+40, &tmp, 0), 0, "disk_read  len=0 returns 0");
 }
 
 TEST(test_disk_wrapper_exact_small) {
     const size_t sec = disk_get_current_disk_logical_sector_size();
-    const uint32_t lba = LBA_BASE + 800;
+    const uint32_t lba = lba_base + 50;
     const size_t len = 4 * sec;
     uint8_t *w = (uint8_t *) kmalloc(len), *r = (uint8_t *) kmalloc(len);
     fill_pattern(w, len, 0x1111);
@@ -139,7 +67,7 @@ TEST(test_disk_wrapper_exact_small) {
 
 TEST(test_disk_wrapper_unaligned_sizes) {
     const size_t sec = disk_get_current_disk_logical_sector_size();
-    const uint32_t bases[] = {LBA_BASE + 1200, LBA_BASE + 1300, LBA_BASE + 1400, LBA_BASE + 1500};
+    const uint32_t bases[] = {lba_base + 60, lba_base + 70, lba_base + 80, lba_base + 90};
     const size_t lens[] = {1, sec - 1, sec + 1, 3 * sec + 123};
     for (int i = 0; i < 4; i++) {
         const uint32_t lba = bases[i];
@@ -204,9 +132,34 @@ TEST(test_slot_allocator_small) {
     CHECK(ok, "disk_free_slot -> slots reusable");
 }
 
+TEST(test_slot_allocator_runs) {
+    const uint32_t per_page = 4096 / disk_get_current_disk_logical_sector_size();
+    const size_t free_before = disk_get_swap_free_slots();
+    const uint32_t run = disk_alloc_slots(3 * per_page);
+    const uint32_t single = disk_alloc_slot();
+    CHECK(run != DISK_NO_SLOT_AVAILABLE && single != DISK_NO_SLOT_AVAILABLE, "disk_alloc_slots run ok");
+    CHECK(single + per_page <= run || single >= run + 3 * per_page, "runs don't overlap");
+    CHECK_EQ(disk_get_swap_free_slots(), free_before - 4 * per_page, "a run takes only the pages it asked for");
+    disk_free_slots(run, 3 * per_page);
+    disk_free_slot(single);
+    CHECK_EQ(disk_get_swap_free_slots(), free_before, "freed runs are given back");
+}
+
+TEST(test_slot_allocator_shared) {
+    const uint32_t per_page = 4096 / disk_get_current_disk_logical_sector_size();
+    const size_t free_before = disk_get_swap_free_slots();
+    const uint32_t run = disk_alloc_slots(2 * per_page);
+    CHECK(run != DISK_NO_SLOT_AVAILABLE, "disk_alloc_slots run ok");
+    disk_get_slots(run, per_page); // only the first page is shared
+    disk_free_slots(run, 2 * per_page);
+    CHECK_EQ(disk_get_swap_free_slots(), free_before - per_page, "a shared page stays allocated");
+    disk_free_slots(run, per_page);
+    CHECK_EQ(disk_get_swap_free_slots(), free_before, "the last reference frees it");
+}
+
 TEST(test_interleaved_writes_reads_small) {
     const size_t sec = disk_get_current_disk_logical_sector_size();
-    const uint32_t lba = LBA_BASE + 3000;
+    const uint32_t lba = lba_base + 100;
     const size_t len1 = 2*sec + 17;
     uint8_t *w1 = (uint8_t *) kmalloc(len1);
     fill_pattern(w1, len1, 0x7777);
@@ -238,29 +191,26 @@ TEST(test_interleaved_writes_reads_small) {
 
 // ---------- Main ----------
 void run_disk_tests(void) {
-    serial_init();
-    serial_puts("\n=== DISK DRIVER TESTS: START ===\n");
-    printf      ("\n=== DISK DRIVER TESTS: START ===\n");
+    const test_suite_t suite = begin_suite("DISK DRIVER");
 
     switch_disk(0);
 
     RUN(test_disk_basic_info);
-    RUN(test_ata_read_write_small_counts);
-    RUN(test_disk_zero_length_rw);
-    RUN(test_disk_wrapper_exact_small);
-    RUN(test_disk_wrapper_unaligned_sizes);
+    lba_base = disk_alloc_slots(LBA_SPAN);
+    CHECK_NE(lba_base, DISK_NO_SLOT_AVAILABLE, "sectors for the raw reads and writes");
+    if (lba_base != DISK_NO_SLOT_AVAILABLE) {
+        RUN(test_ata_read_write_small_counts);
+        RUN(test_disk_zero_length_rw);
+        RUN(test_disk_wrapper_exact_small);
+        RUN(test_disk_wrapper_unaligned_sizes);
+        RUN(test_interleaved_writes_reads_small);
+        disk_free_slots(lba_base, LBA_SPAN);
+    }
     RUN(test_ata_oob_guard);
     RUN(test_switch_disk_invalid);
     RUN(test_slot_allocator_small);
-    RUN(test_interleaved_writes_reads_small);
-
-    const int failed = g_failures;
-    printf("\n=== DISK DRIVER TESTS: %s (%d failed of %d) ===\n",
-           failed ? "FAILED" : "PASSED", g_failures, g_tests_run);
-    serial_puts("\n=== DISK DRIVER TESTS: ");
-    serial_puts(failed ? "FAILED" : "PASSED");
-    serial_puts(" ===\n");
+    RUN(test_slot_allocator_runs);
+    RUN(test_slot_allocator_shared);
 
-    if (failed) qemu_exit_fail();
-    else        qemu_exit_pass();
+    end_suite(&suite);
 }
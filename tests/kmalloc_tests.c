@@ -0,0 +1,315 @@
+// tests/kmalloc_tests.c
+#include "../memory/kmalloc.h"
+#include "../memory/pmm.h"
+#include "../memory/utills.h"
+#include "test_framework.h"
+#include "kmalloc_tests.h"
+
+#define SLAB_TEST_CACHE 3 // the 64 bytes cache
+#define SLAB_TEST_OBJECTS 128
+#define HEAP_GROW_OBJECTS 200 // more slabs than the fixed heap window used to hold
+
+TEST(test_kmalloc_slab_lists) {
+    const kmalloc_cache_stats_t before = kmalloc_get_cache_stats(SLAB_TEST_CACHE);
+    void *objects[SLAB_TEST_OBJECTS];
+    bool ok = true;
+    for (size_t i = 0; i < SLAB_TEST_OBJECTS; i++) {
+        objects[i] = kmalloc(before.object_size);
+        if (objects[i] == NULL)
+            ok = false;
+    }
+    CHECK(ok, "objects allocated");
+    const kmalloc_cache_stats_t filled = kmalloc_get_cache_stats(SLAB_TEST_CACHE);
+    CHECK(filled.full_slabs > before.full_slabs, "filled slabs move to the full list");
+
+    for (size_t i = 0; i < SLAB_TEST_OBJECTS; i++)
+        kfree(objects[i]);
+    const kmalloc_cache_stats_t after = kmalloc_get_cache_stats(SLAB_TEST_CACHE);
+    CHECK_EQ(after.full_slabs, before.full_slabs, "full slabs restored after free");
+    CHECK_EQ(after.partial_slabs, before.partial_slabs, "partial slabs restored after free");
+    CHECK(after.empty_slabs >= before.empty_slabs, "slabs that were emptied are on the empty list");
+}
+
+TEST(test_kmalloc_reuses_empty_slab) {
+    void *object = kmalloc(kmalloc_get_cache_stats(SLAB_TEST_CACHE).object_size);
+    CHECK_NE(object, NULL, "object allocated");
+    kfree(object);
+    const kmalloc_cache_stats_t before = kmalloc_get_cache_stats(SLAB_TEST_CACHE);
+    object = kmalloc(before.object_size);
+    const kmalloc_cache_stats_t after = kmalloc_get_cache_stats(SLAB_TEST_CACHE);
+    CHECK_EQ(after.partial_slabs + after.full_slabs + after.empty_slabs,
+             before.partial_slabs + before.full_slabs + before.empty_slabs, "no new slab for a single object");
+    kfree(object);
+}
+
+TEST(test_kmalloc_shrink_keeps_reserve) {
+    void *objects[SLAB_TEST_OBJECTS];
+    const size_t object_size = kmalloc_get_cache_stats(SLAB_TEST_CACHE).object_size;
+    for (size_t i = 0; i < SLAB_TEST_OBJECTS; i++)
+        objects[i] = kmalloc(object_size);
+    for (size_t i = 0; i < SLAB_TEST_OBJECTS; i++)
+        kfree(objects[i]);
+    const kmalloc_cache_stats_t before = kmalloc_get_cache_stats(SLAB_TEST_CACHE);
+    CHECK(before.empty_slabs > KMALLOC_EMPTY_SLABS_RESERVE, "freeing the objects left empty slabs");
+
+    const size_t free_before = pmm_get_free_frames_count();
+    const size_t freed = pmm_shrink((size_t) -1);
+    const kmalloc_cache_stats_t after = kmalloc_get_cache_stats(SLAB_TEST_CACHE);
+    CHECK_EQ(after.empty_slabs, KMALLOC_EMPTY_SLABS_RESERVE, "the reserve of empty slabs is kept");
+    CHECK(freed >= before.empty_slabs - KMALLOC_EMPTY_SLABS_RESERVE, "the extra empty slabs were freed");
+    CHECK_EQ(pmm_get_free_frames_count(), free_before + freed, "the frames of the slabs went back to the pmm");
+
+    void *object = kmalloc(object_size);
+    CHECK_NE(object, NULL, "allocation after shrinking");
+    kfree(object);
+}
+
+TEST(test_kmalloc_heap_grows) {
+    static void *objects[HEAP_GROW_OBJECTS];
+    const size_t largest = kmalloc_get_cache_stats(NUM_CACHES - 1).object_size; // one object per slab
+    bool ok = true;
+    for (size_t i = 0; i < HEAP_GROW_OBJECTS; i++) {
+        objects[i] = kmalloc(largest);
+        if (objects[i] == NULL)
+            ok = false;
+        else
+            memset(objects[i], (uint8_t) i, largest);
+    }
+    CHECK(ok, "the heap grew past the old window");
+    CHECK(kmalloc_get_cache_stats(NUM_CACHES - 1).full_slabs >= HEAP_GROW_OBJECTS, "every object has its own slab");
+
+    bool intact = true;
+    for (size_t i = 0; i < HEAP_GROW_OBJECTS; i++) {
+        if (objects[i] != NULL && ((uint8_t *) objects[i])[largest - 1] != (uint8_t) i)
+            intact = false;
+        kfree(objects[i]);
+    }
+    CHECK(intact, "the objects don't overlap");
+    pmm_shrink((size_t) -1);
+    CHECK_EQ(kmalloc_get_cache_stats(NUM_CACHES - 1).empty_slabs, KMALLOC_EMPTY_SLABS_RESERVE,
+             "the heap shrinks back");
+}
+
+typedef struct {
+    uint32_t words[10]; // 40 bytes, the size class would round it up to 64
+    uint32_t magic;
+} typed_object_t;
+
+#define TYPED_OBJECT_MAGIC 0xC0FFEEu
+#define TYPED_ALIGN 64u
+
+static void typed_object_ctor(void *object) {
+    ((typed_object_t *) object)->magic = TYPED_OBJECT_MAGIC;
+}
+
+TEST(test_kmem_cache_typed) {
+    kmem_cache_t *packed = kmem_cache_create("test_packed", 40, 0, NULL);
+    CHECK_NE(packed, NULL, "packed cache created");
+    void *a = kmem_cache_alloc(packed);
+    void *b = kmem_cache_alloc(packed);
+    CHECK_EQ((uint32_t) b - (uint32_t) a, 40, "objects are packed by their size");
+    kmem_cache_free(packed, b);
+    kfree(a); // kfree finds the cache by itself
+
+    kmem_cache_t *constructed = kmem_cache_create("test_ctor", sizeof(typed_object_t), TYPED_ALIGN, typed_object_ctor);
+    CHECK_NE(constructed, NULL, "constructed cache created");
+    typed_object_t *object = kmem_cache_alloc(constructed);
+    CHECK_EQ((uint32_t) object & (TYPED_ALIGN - 1), 0, "object is aligned");
+    CHECK_EQ(object->magic, TYPED_OBJECT_MAGIC, "object is constructed");
+    object->words[0] = 1;
+    kmem_cache_free(constructed, object);
+    CHECK_EQ(object->magic, TYPED_OBJECT_MAGIC, "freeing keeps the constructed state");
+    CHECK_EQ(kmem_cache_get_stats(constructed).empty_slabs, 1, "the slab is empty again");
+}
+
+#define LARGE_TEST_SIZE (3 * PMM_BLOCK_SIZE)
+
+TEST(test_kmalloc_large_reuses_range) {
+    void *first = kmalloc(LARGE_TEST_SIZE);
+    CHECK_NE(first, NULL, "large allocation");
+    kfree(first);
+    void *again = kmalloc(LARGE_TEST_SIZE);
+    CHECK_EQ(again, first, "the freed range is reused");
+    kfree(again);
+
+    // Way more than the window holds if the ranges were not reused
+    bool ok = true;
+    for (size_t i = 0; i < KERNEL_LARGE_HEAP_SIZE / LARGE_TEST_SIZE * 2 && ok; i++) {
+        void *ptr = kmalloc(LARGE_TEST_SIZE);
+        ok = ptr != NULL;
+        kfree(ptr);
+    }
+    CHECK(ok, "alloc and free cycles don't leak the window");
+}
+
+#define HUGE_TEST_PAGES (((size_t) 1 << BUDDY_MAX_ORDER) + 2) // more than a single buddy block holds
+
+TEST(test_kmalloc_larger_than_block) {
+    uint8_t *huge = kmalloc(HUGE_TEST_PAGES * PMM_BLOCK_SIZE);
+    CHECK_NE(huge, NULL, "an allocation bigger than a buddy block");
+    if (huge == NULL)
+        return;
+    huge[0] = 0x5A;
+    huge[HUGE_TEST_PAGES * PMM_BLOCK_SIZE - 1] = 0xA5;
+    CHECK_EQ(huge[0], 0x5A, "its first page is mapped");
+    CHECK_EQ(huge[HUGE_TEST_PAGES * PMM_BLOCK_SIZE - 1], 0xA5, "its last page is mapped");
+    kfree(huge);
+    void *again = kmalloc(HUGE_TEST_PAGES * PMM_BLOCK_SIZE);
+    CHECK_EQ(again, huge, "the freed blocks are reused");
+    kfree(again);
+}
+
+TEST(test_kmalloc_size_classes) {
+    size_t prev_size = 0;
+    bool dense = true;
+    for (size_t i = 0; i < NUM_CACHES; i++) {
+        const size_t size = kmalloc_get_cache_stats(i).object_size;
+        // No class is more than a quarter bigger than the one before it, after the first 128 bytes
+        if (size <= prev_size || (size > 128 && size - prev_size > prev_size / 4))
+            dense = false;
+        prev_size = size;
+    }
+    CHECK(dense, "size classes are dense");
+    CHECK_EQ(prev_size, MAX_CACHE_SIZE, "the last class is MAX_CACHE_SIZE");
+
+    const size_t class_520 = 16; // the 640 bytes class
+    const kmalloc_cache_stats_t before = kmalloc_get_cache_stats(class_520);
+    void *object = kmalloc(520);
+    const kmalloc_cache_stats_t after = kmalloc_get_cache_stats(class_520);
+    CHECK_EQ(after.object_size, 640, "520 bytes go to the 640 bytes class");
+    CHECK_EQ(after.allocations, before.allocations + 1, "the allocation was counted by its class");
+    CHECK_EQ(after.wasted_bytes - before.wasted_bytes, 640 - 520, "the internal fragmentation was counted");
+    kfree(object);
+
+    void *exact = kmalloc(48);
+    CHECK_EQ(kmalloc_get_cache_stats(2).object_size, 48, "48 bytes have a class of their own");
+    kfree(exact);
+}
+
+#define COLORED_OBJECT_SIZE 120 // leaves more than a cache line after the objects of a slab
+#define COLORED_OBJECTS 64      // more than a slab holds
+
+TEST(test_kmem_cache_coloring) {
+    kmem_cache_t *cache = kmem_cache_create("test_colored", COLORED_OBJECT_SIZE, 0, NULL);
+    CHECK_NE(cache, NULL, "cache created");
+    void *objects[COLORED_OBJECTS];
+    for (size_t i = 0; i < COLORED_OBJECTS; i++)
+        objects[i] = kmem_cache_alloc(cache);
+
+    const uint32_t first_page = (uint32_t) objects[0] & ~(PMM_BLOCK_SIZE - 1);
+    size_t other = 0;
+    while (other < COLORED_OBJECTS && ((uint32_t) objects[other] & ~(PMM_BLOCK_SIZE - 1)) == first_page)
+        other++;
+    CHECK(other < COLORED_OBJECTS, "the objects took a second slab");
+    if (other < COLORED_OBJECTS)
+        CHECK_NE((uint32_t) objects[other] & (PMM_BLOCK_SIZE - 1), (uint32_t) objects[0] & (PMM_BLOCK_SIZE - 1),
+                 "the second slab starts at another color");
+
+    for (size_t i = 0; i < COLORED_OBJECTS; i++)
+        kmem_cache_free(cache, objects[i]);
+}
+
+#define ALIGNED_TEST_ALIGN (4 * PMM_BLOCK_SIZE)
+
+TEST(test_kmalloc_aligned) {
+    void *page = kmalloc_aligned(100, PMM_BLOCK_SIZE);
+    void *block = kmalloc_aligned(PMM_BLOCK_SIZE, ALIGNED_TEST_ALIGN);
+    void *small = kmalloc_aligned(24, KMALLOC_ALIGN);
+    CHECK(page != NULL && block != NULL && small != NULL, "aligned allocations");
+    CHECK_EQ((uint32_t) page & (PMM_BLOCK_SIZE - 1), 0, "page aligned");
+    CHECK_EQ((uint32_t) block & (ALIGNED_TEST_ALIGN - 1), 0, "aligned above a page");
+    CHECK_EQ((uint32_t) small & (KMALLOC_ALIGN - 1), 0, "small alignment from the size classes");
+    kfree(page);
+    kfree(block);
+    kfree(small);
+}
+
+TEST(test_krealloc) {
+    uint8_t *object = kmalloc(40);
+    object[0] = 0x5A;
+    CHECK_EQ(krealloc(object, 48), object, "grows in place inside its size class");
+    uint8_t *moved = krealloc(object, 100);
+    CHECK(moved != NULL && moved != object, "moves to a bigger class");
+    CHECK_EQ(moved[0], 0x5A, "the content moved with it");
+
+    uint8_t *large = krealloc(moved, 2 * PMM_BLOCK_SIZE);
+    CHECK_NE(large, NULL, "moves to the large heap");
+    CHECK_EQ(large[0], 0x5A, "the content moved to the large heap");
+    // A free block of the window is aligned to its size, so an 8 pages aligned allocation is followed by free pages
+    uint8_t *grown = krealloc(kmalloc_aligned(PMM_BLOCK_SIZE, 8 * PMM_BLOCK_SIZE), 3 * PMM_BLOCK_SIZE);
+    CHECK_NE(grown, NULL, "large allocation");
+    CHECK_EQ(krealloc(grown, 6 * PMM_BLOCK_SIZE), grown, "a large allocation grows in place over free pages");
+    grown[6 * PMM_BLOCK_SIZE - 1] = 1;
+    CHECK_EQ(krealloc(grown, PMM_BLOCK_SIZE), grown, "a large allocation shrinks in place");
+    kfree(grown);
+    kfree(large);
+    void *fresh = krealloc(NULL, 10);
+    CHECK_NE(fresh, NULL, "krealloc of NULL allocates");
+    kfree(fresh);
+}
+
+#ifdef KMALLOC_PROFILE
+#define PROFILE_TEST_SIZE 1000 // the 1024 bytes class, nothing else in the tests uses it
+#define PROFILE_TEST_OBJECTS 7
+#define PROFILE_TEST_CLASS 19
+
+// Finds the site that holds at least `objects` live objects of the class, returns its index or -1
+static int find_profile_site(const kmalloc_site_stats_t *sites, size_t count, uint32_t size_class, uint32_t objects) {
+    for (size_t i = 0; i < count; i++) {
+        if (sites[i].size_class == size_class && sites[i].live_objects >= objects)
+            return (int) i;
+    }
+    return -1;
+}
+
+TEST(test_kmalloc_profile_sites) {
+    static kmalloc_site_stats_t sites[KMALLOC_PROFILE_SITES];
+    void *objects[PROFILE_TEST_OBJECTS];
+    for (size_t i = 0; i < PROFILE_TEST_OBJECTS; i++)
+        objects[i] = kmalloc(PROFILE_TEST_SIZE);
+
+    size_t count = kmalloc_profile_get_sites(sites, KMALLOC_PROFILE_SITES);
+    const int index = find_profile_site(sites, count, PROFILE_TEST_CLASS, PROFILE_TEST_OBJECTS);
+    CHECK(index >= 0, "the allocations are charged to their site");
+    if (index < 0)
+        return;
+    const kmalloc_site_stats_t before = sites[index];
+    CHECK_EQ(before.live_bytes, before.live_objects * kmalloc_get_cache_stats(PROFILE_TEST_CLASS).object_size,
+             "live bytes are counted by the size of the class");
+
+    for (size_t i = 0; i < PROFILE_TEST_OBJECTS; i++)
+        kfree(objects[i]);
+    count = kmalloc_profile_get_sites(sites, KMALLOC_PROFILE_SITES);
+    bool found = false;
+    for (size_t i = 0; i < count; i++) {
+        if (sites[i].site == before.site && sites[i].size_class == PROFILE_TEST_CLASS) {
+            found = true;
+            CHECK_EQ(sites[i].live_objects, before.live_objects - PROFILE_TEST_OBJECTS, "frees are charged back");
+            CHECK_EQ(sites[i].allocations, before.allocations, "the allocations stay counted");
+        }
+    }
+    CHECK(found, "the site is still in the table");
+}
+#endif
+
+// ---------- Main ----------
+void run_kmalloc_tests(void) {
+    const test_suite_t suite = begin_suite("KMALLOC");
+
+    RUN(test_kmalloc_slab_lists);
+    RUN(test_kmalloc_reuses_empty_slab);
+    RUN(test_kmalloc_shrink_keeps_reserve);
+    RUN(test_kmalloc_heap_grows);
+    RUN(test_kmem_cache_typed);
+    RUN(test_kmalloc_large_reuses_range);
+    RUN(test_kmalloc_larger_than_block);
+    RUN(test_kmalloc_size_classes);
+    RUN(test_kmem_cache_coloring);
+    RUN(test_kmalloc_aligned);
+    RUN(test_krealloc);
+#ifdef KMALLOC_PROFILE
+    RUN(test_kmalloc_profile_sites);
+#endif
+
+    end_suite(&suite);
+}
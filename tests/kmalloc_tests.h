@@ -0,0 +1,9 @@
+//
+// Created by Yoav on 10/18/2026.
+//
+
+#ifndef MYKERNEL_KMALLOC_TESTS_H
+#define MYKERNEL_KMALLOC_TESTS_H
+
+void run_kmalloc_tests();
+#endif //MYKERNEL_KMALLOC_TESTS_H
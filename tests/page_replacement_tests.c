@@ -0,0 +1,223 @@
+// tests/page_replacement_tests.c
+#include "../memory/page_replacement.h"
+#include "../memory/vmm.h"
+#include "../memory/pmm.h"
+#include "../memory/utills.h"
+#include "../memory/kmalloc.h"
+#include "../memory/kswapd.h"
+#include "../drivers/disk.h"
+#include "test_framework.h"
+#include "page_replacement_tests.h"
+
+#define TEST_PAGE_ADDR 0x40000000u // Nothing is mapped there in the kernel vm context
+#define TEST_PAGE_OFFSET 0x123u    // The fault is in the middle of the page
+#define CLUSTER_TEST_ADDR 0x40400000u // The swap tests use a page table of their own
+#define CLUSTER_TEST_PAGES 4u
+#define READAHEAD_TEST_PAGES VMM_SWAP_CLUSTER_PAGES // Two such runs, one after the other
+
+static const page_replacement_policy_t *find_policy(const char *name) {
+    size_t count;
+    const page_replacement_policy_t *policies = page_replacement_get_policies(&count);
+    for (size_t i = 0; i < count; i++)
+        if (!strcmp(policies[i].name, name))
+            return &policies[i];
+    return NULL;
+}
+
+/*
+ * A page evicted from probation and faulted back in goes to the main queue. The lists of 2Q are empty while
+ * another policy is active, so the test drives its hooks directly on a single page.
+ */
+TEST(test_2q_promotes_swapped_in_ghost) {
+    const page_replacement_policy_t *two_q = find_policy("2q");
+    CHECK_NE(two_q, NULL, "2q policy exists");
+    if (two_q == NULL || two_q == page_replacement_current()) {
+        printf("2q is the active policy, its lists are in use - skipped\n");
+        return;
+    }
+
+    // A demand zero fault on an address in the middle of the page
+    volatile uint8_t *page = (volatile uint8_t *) TEST_PAGE_ADDR;
+    page[TEST_PAGE_OFFSET] = 0x5A;
+    const physical_addr frame_addr = vmm_calc_phys_addr((void *) page) & ~(PAGE_SIZE - 1);
+    pmm_frame_t *frame = pmm_frame_of(frame_addr);
+    CHECK(page_replacement_is_tracked(frame_addr), "the faulted page is tracked");
+    CHECK_EQ(frame->vir_addr, TEST_PAGE_ADDR, "the page is tracked by its page address");
+
+    // Move the page from the active policy to 2Q, it starts in probation
+    page_replacement_page_out(frame_addr);
+    two_q->page_in(frame_addr, (void *) frame->vir_addr, false);
+    CHECK(!(frame->flags & PMM_FRAME_ACTIVE), "a new page goes to probation");
+
+    // Choosing a victim alone doesn't make it a ghost, its write may still fail
+    CHECK_EQ(two_q->choose_victim(), (void *) TEST_PAGE_ADDR, "the probation page is the victim");
+    two_q->page_out(frame_addr);
+    two_q->page_in(frame_addr, (void *) TEST_PAGE_ADDR, true);
+    CHECK(!(frame->flags & PMM_FRAME_ACTIVE), "a victim that wasn't evicted is no ghost");
+
+    // Evicted from probation it becomes a ghost, and coming back from the disk it goes to the main queue
+    CHECK_EQ(two_q->choose_victim(), (void *) TEST_PAGE_ADDR, "the probation page is the victim");
+    two_q->evicted(frame_addr);
+    two_q->page_out(frame_addr);
+    two_q->page_in(frame_addr, (void *) TEST_PAGE_ADDR, true);
+    CHECK(frame->flags & PMM_FRAME_ACTIVE, "the swapped in ghost lands in the main queue");
+
+    two_q->page_out(frame_addr);
+    page_replacement_page_in(frame_addr, (void *) TEST_PAGE_ADDR, false);
+    CHECK_EQ(page[TEST_PAGE_OFFSET], 0x5A, "the page kept its data");
+    vmm_unmap_page((void *) TEST_PAGE_ADDR);
+    CHECK(!page_replacement_is_tracked(frame_addr), "the unmapped page is not tracked");
+}
+
+// Demand zero faults the pages in and fills every page with a byte of its index, starting at 1
+static void fill_test_pages(uint8_t *pages, size_t count) {
+    for (size_t i = 0; i < count; i++)
+        memset(pages + i * PAGE_SIZE, (uint8_t) (i + 1), PAGE_SIZE);
+}
+
+// return true if every page still holds the byte fill_test_pages gave it, swapping them back in if needed
+static bool test_pages_intact(const volatile uint8_t *pages, size_t count) {
+    bool intact = true;
+    for (size_t i = 0; i < count; i++)
+        for (size_t j = 0; j < PAGE_SIZE; j++)
+            intact &= pages[i * PAGE_SIZE + j] == (uint8_t) (i + 1);
+    return intact;
+}
+
+static void unmap_test_pages(uint8_t *pages, size_t count) {
+    for (size_t i = 0; i < count; i++)
+        vmm_unmap_page(pages + i * PAGE_SIZE);
+}
+
+/*
+ * Two pages enter the clock one after the other, the first accessed and the second idle. When the hand gets
+ * to them the accessed one gets its second chance and the idle one right after it is the victim.
+ * The clock is the active policy, so the hand first goes through the idle pages of the rest of the kernel.
+ */
+TEST(test_clock_second_chance) {
+    if (strcmp(page_replacement_current()->name, "clock") != 0) {
+        printf("clock isn't the active policy - skipped\n");
+        return;
+    }
+    volatile uint8_t *accessed = (volatile uint8_t *) CLUSTER_TEST_ADDR;
+    volatile uint8_t *idle = accessed + PAGE_SIZE;
+    fill_test_pages((uint8_t *) accessed, 2);
+    const physical_addr idle_frame = vmm_calc_phys_addr((void *) idle) & ~(PAGE_SIZE - 1);
+    const physical_addr accessed_frame = vmm_calc_phys_addr((void *) accessed) & ~(PAGE_SIZE - 1);
+    CHECK_EQ(vmm_page_test_and_clear_accessed(idle_frame), PAGE_ACCESSED, "the new page was accessed");
+    (void) accessed[0];
+
+    void *victim;
+    do
+        victim = page_replacement_choose_victim();
+    while (victim != NULL && victim != (void *) accessed && victim != (void *) idle);
+    CHECK_EQ(victim, (void *) idle, "the hand passes the accessed page and takes the idle one");
+    CHECK(page_replacement_is_tracked(accessed_frame), "the accessed page survived the sweep");
+    CHECK_EQ(vmm_page_test_and_clear_accessed(accessed_frame), PAGE_IDLE, "its second chance is used up");
+    unmap_test_pages((uint8_t *) accessed, 2);
+}
+
+TEST(test_swap_out_range_consecutive_slots) {
+    uint8_t *pages = (uint8_t *) CLUSTER_TEST_ADDR;
+    fill_test_pages(pages, CLUSTER_TEST_PAGES);
+    const size_t swapped = vmm_swap_out_range(pages, CLUSTER_TEST_PAGES);
+    CHECK_EQ(swapped, CLUSTER_TEST_PAGES, "the adjacent pages are swapped out with one write");
+    if (swapped == CLUSTER_TEST_PAGES) {
+        const uint32_t sectors_per_page = PAGE_SIZE / disk_get_current_disk_logical_sector_size();
+        const uint32_t first_slot = vmm_get_swap_slot(pages);
+        bool consecutive = first_slot != DISK_NO_SLOT_AVAILABLE;
+        for (size_t i = 1; i < CLUSTER_TEST_PAGES; i++)
+            consecutive &= vmm_get_swap_slot(pages + i * PAGE_SIZE) == first_slot + i * sectors_per_page;
+        CHECK(consecutive, "the pages got consecutive slots");
+    }
+    CHECK(test_pages_intact(pages, CLUSTER_TEST_PAGES), "the pages read back with their data");
+    unmap_test_pages(pages, CLUSTER_TEST_PAGES);
+}
+
+/*
+ * A read-ahead nobody used halves the window of the next fault, a read-ahead that was used doubles it.
+ * Two runs of swapped out pages: the first fault on run A reads ahead pages that are never touched, then the
+ * faults on run B go through it in order
+ */
+TEST(test_readahead_window_adapts) {
+    volatile uint8_t *run_a = (volatile uint8_t *) CLUSTER_TEST_ADDR;
+    volatile uint8_t *run_b = run_a + READAHEAD_TEST_PAGES * PAGE_SIZE;
+    fill_test_pages((uint8_t *) run_a, 2 * READAHEAD_TEST_PAGES);
+    const bool swapped = vmm_swap_out_range((void *) run_a, READAHEAD_TEST_PAGES) == READAHEAD_TEST_PAGES &&
+                         vmm_swap_out_range((void *) run_b, READAHEAD_TEST_PAGES) == READAHEAD_TEST_PAGES;
+    CHECK(swapped, "both runs are swapped out");
+    if (swapped) {
+        (void) run_a[0];
+        const size_t missed_window = vmm_get_readahead_window();
+        (void) run_b[0];
+        const size_t window = vmm_get_readahead_window();
+        CHECK(window < missed_window || missed_window == VMM_SWAP_READAHEAD_MIN, "the window shrinks on a miss");
+
+        // The window is at most half of the run now, so the page after it is still on the disk
+        for (size_t i = 1; i <= window; i++)
+            (void) run_b[i * PAGE_SIZE];
+        CHECK_EQ(vmm_get_readahead_window(), window * 2, "the window grows on sequential faults");
+    }
+    CHECK(test_pages_intact(run_a, 2 * READAHEAD_TEST_PAGES), "the pages read back with their data");
+    unmap_test_pages((uint8_t *) run_a, 2 * READAHEAD_TEST_PAGES);
+}
+
+// return the free frames of the normal zone, the ones in the frame cache and the zeroed pool included
+static size_t normal_zone_free_frames() {
+    const pmm_zone_stats_t zone = pmm_get_zone_stats(ZONE_NORMAL);
+    return zone.free_frames + zone.cached_frames;
+}
+
+/*
+ * Takes frames until the normal zone is low and lets kswapd run. It has to reclaim until the zone is back
+ * above its high watermark and go to sleep. The test pages make sure there is enough to swap out
+ */
+TEST(test_kswapd_reclaims_to_high_watermark) {
+    const pmm_zone_stats_t zone = pmm_get_zone_stats(ZONE_NORMAL);
+    const size_t test_pages = zone.watermark_high - zone.watermark_low + 2 * VMM_SWAP_CLUSTER_PAGES;
+    uint8_t *pages = (uint8_t *) CLUSTER_TEST_ADDR;
+    fill_test_pages(pages, test_pages);
+
+    const size_t max_taken = normal_zone_free_frames();
+    physical_addr *taken = kmalloc(max_taken * sizeof(physical_addr));
+    CHECK_NE(taken, NULL, "room for the frames that are taken");
+    if (taken == NULL) {
+        unmap_test_pages(pages, test_pages);
+        return;
+    }
+    size_t taken_count = 0;
+    while (taken_count < max_taken && !pmm_zone_is_low(ZONE_NORMAL)) {
+        taken[taken_count] = pmm_alloc_frame();
+        if (taken[taken_count] == PMM_NO_FRAME_AVAILABLE)
+            break;
+        taken_count++;
+    }
+    CHECK(pmm_zone_is_low(ZONE_NORMAL), "the normal zone is low");
+
+    const size_t reclaimed_before = kswapd_get_stats().frames_reclaimed;
+    kswapd_wake();
+    const size_t reclaimed = kswapd_run((size_t) -1);
+    CHECK(reclaimed > 0, "kswapd reclaimed frames");
+    CHECK(normal_zone_free_frames() >= zone.watermark_high, "the zone is back above its high watermark");
+    CHECK_EQ(kswapd_get_stats().frames_reclaimed, reclaimed_before + reclaimed, "the reclaimed frames are counted");
+    CHECK_EQ(kswapd_run(1), 0, "kswapd went to sleep");
+
+    for (size_t i = 0; i < taken_count; i++)
+        pmm_free_frame(taken[i]);
+    kfree(taken);
+    CHECK(test_pages_intact(pages, test_pages), "the pages read back with their data");
+    unmap_test_pages(pages, test_pages);
+}
+
+// ---------- Main ----------
+void run_page_replacement_tests(void) {
+    const test_suite_t suite = begin_suite("PAGE REPLACEMENT");
+
+    RUN(test_2q_promotes_swapped_in_ghost);
+    RUN(test_clock_second_chance);
+    RUN(test_swap_out_range_consecutive_slots);
+    RUN(test_readahead_window_adapts);
+    RUN(test_kswapd_reclaims_to_high_watermark);
+
+    end_suite(&suite);
+}
@@ -0,0 +1,9 @@
+//
+// Created by Yoav on 10/18/2026.
+//
+
+#ifndef MYKERNEL_PAGE_REPLACEMENT_TESTS_H
+#define MYKERNEL_PAGE_REPLACEMENT_TESTS_H
+
+void run_page_replacement_tests();
+#endif //MYKERNEL_PAGE_REPLACEMENT_TESTS_H
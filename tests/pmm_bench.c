@@ -0,0 +1,174 @@
+// tests/pmm_bench.c
+/*
+ * Microbenchmark of the frame search: the old next-fit byte/bit scan of the PMM bitmap against the
+ * summary bitmap the buddy allocator uses now.
+ * Both are run over the same random occupancy pattern of 4GB worth of frames, and every round frees a
+ * burst of random used frames and allocates the same amount back, so the occupancy stays constant.
+ * Built with -DRUN_BENCHMARKS, the results go to the screen and to COM1.
+ */
+#include "../memory/kmalloc.h"
+#include "../memory/summary_bitmap.h"
+#include "../std/stdlib.h"
+#include "test_framework.h"
+#include "pmm_bench.h"
+
+#define BENCH_FRAMES (1024u * 1024u) // 4GB of 4KB frames, the size of the old fixed bitmap
+#define BENCH_BITMAP_SIZE (BENCH_FRAMES / 8u)
+#define BENCH_ROUNDS 256u
+#define BENCH_BURST 16u
+
+static inline uint64_t rdtsc() {
+    uint32_t low, high;
+    asm volatile ("rdtsc" : "=a"(low), "=d"(high));
+    return ((uint64_t) high << 32) | low;
+}
+
+static uint32_t bench_seed;
+
+static inline uint32_t bench_random() {
+    bench_seed = bench_seed * 1664525u + 1013904223u;
+    return bench_seed >> 8;
+}
+
+// ---------- The old next-fit allocator (bit set = used) ----------
+static uint8_t *legacy_bitmap;
+static size_t legacy_last_alloc_index;
+static int32_t legacy_last_free_frame;
+
+static inline bool legacy_is_used(size_t frame) {
+    return legacy_bitmap[frame / 8] & (1 << (frame % 8));
+}
+
+static size_t legacy_alloc() {
+    if (legacy_last_free_frame != -1) {
+        const size_t frame = legacy_last_free_frame;
+        legacy_bitmap[frame / 8] |= 1 << (frame % 8);
+        legacy_last_free_frame = -1;
+        return frame;
+    }
+    for (size_t pass = 0; pass < 2; pass++) {
+        const size_t start = pass == 0 ? legacy_last_alloc_index : 1;
+        const size_t end = pass == 0 ? BENCH_BITMAP_SIZE : legacy_last_alloc_index;
+        for (size_t i = start; i < end; i++) {
+            if (legacy_bitmap[i] == 0xFF)
+                continue;
+            for (uint8_t j = 0; j < 8; j++) {
+                if (!(legacy_bitmap[i] & (1 << j))) {
+                    legacy_bitmap[i] |= 1 << j;
+                    legacy_last_alloc_index = i;
+                    return i * 8 + j;
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+static void legacy_free(size_t frame) {
+    legacy_bitmap[frame / 8] &= ~(1 << (frame % 8));
+    legacy_last_free_frame = frame;
+}
+
+// ---------- The summary bitmap (bit set = free) ----------
+static summary_bitmap_t summary;
+
+static size_t summary_alloc() {
+    const size_t frame = summary_bitmap_find_first(&summary);
+    summary_bitmap_clear(&summary, frame);
+    return frame;
+}
+
+// Builds the same pattern in both allocators, `percent` of the frames are used
+static void bench_fill(uint8_t percent) {
+    legacy_last_alloc_index = 1;
+    legacy_last_free_frame = -1;
+    for (size_t frame = 0; frame < BENCH_FRAMES; frame++) {
+        const bool used = frame < 8 || bench_random() % 100 < percent; // frames 0-7 are never allocated
+        if (used) {
+            legacy_bitmap[frame / 8] |= 1 << (frame % 8);
+            summary_bitmap_clear(&summary, frame);
+        } else {
+            legacy_bitmap[frame / 8] &= ~(1 << (frame % 8));
+            summary_bitmap_set(&summary, frame);
+        }
+    }
+}
+
+static size_t bench_random_used_frame() {
+    size_t frame;
+    do {
+        frame = 8 + bench_random() % (BENCH_FRAMES - 8);
+    } while (!legacy_is_used(frame));
+    return frame;
+}
+
+static void bench_print(const char *name, uint8_t percent, uint64_t cycles) {
+    char buffer[16];
+    const int per_alloc = (int) (cycles / (BENCH_ROUNDS * BENCH_BURST));
+    printf("%s %d%% occupancy: %d cycles per allocation\n", name, percent, per_alloc);
+    serial_puts(name);
+    serial_puts(" ");
+    int_to_string(percent, buffer);
+    serial_puts(buffer);
+    serial_puts("% occupancy: ");
+    int_to_string(per_alloc, buffer);
+    serial_puts(buffer);
+    serial_puts(" cycles per allocation\n");
+}
+
+static void bench_occupancy(uint8_t percent) {
+    size_t frames[BENCH_BURST];
+    uint64_t legacy_cycles = 0, summary_cycles = 0;
+
+    bench_seed = percent;
+    bench_fill(percent);
+    for (size_t round = 0; round < BENCH_ROUNDS; round++) {
+        for (size_t i = 0; i < BENCH_BURST; i++) {
+            frames[i] = bench_random_used_frame();
+            legacy_free(frames[i]);
+        }
+        const uint64_t start = rdtsc();
+        for (size_t i = 0; i < BENCH_BURST; i++)
+            frames[i] = legacy_alloc();
+        legacy_cycles += rdtsc() - start;
+    }
+
+    bench_seed = percent;
+    bench_fill(percent);
+    for (size_t round = 0; round < BENCH_ROUNDS; round++) {
+        for (size_t i = 0; i < BENCH_BURST; i++) {
+            frames[i] = bench_random_used_frame();
+            legacy_bitmap[frames[i] / 8] &= ~(1 << (frames[i] % 8)); // keep the used frame lookup in sync
+            summary_bitmap_set(&summary, frames[i]);
+        }
+        const uint64_t start = rdtsc();
+        for (size_t i = 0; i < BENCH_BURST; i++)
+            frames[i] = summary_alloc();
+        summary_cycles += rdtsc() - start;
+        for (size_t i = 0; i < BENCH_BURST; i++)
+            legacy_bitmap[frames[i] / 8] |= 1 << (frames[i] % 8);
+    }
+
+    bench_print("next-fit bitmap", percent, legacy_cycles);
+    bench_print("summary bitmap ", percent, summary_cycles);
+}
+
+void run_pmm_bench(void) {
+    static const uint8_t occupancies[] = {10, 50, 90, 99};
+    serial_puts("\n=== PMM FRAME SEARCH BENCHMARK ===\n");
+    printf      ("\n=== PMM FRAME SEARCH BENCHMARK ===\n");
+
+    legacy_bitmap = kmalloc(BENCH_BITMAP_SIZE);
+    uint32_t *summary_storage = kmalloc(SUMMARY_BITMAP_WORDS(BENCH_FRAMES) * sizeof(uint32_t));
+    if (legacy_bitmap == NULL || summary_storage == NULL) {
+        printf("Not enough memory for the benchmark\n");
+        return;
+    }
+    summary_bitmap_init(&summary, BENCH_FRAMES, summary_storage);
+
+    for (size_t i = 0; i < sizeof(occupancies) / sizeof(occupancies[0]); i++)
+        bench_occupancy(occupancies[i]);
+
+    kfree(summary_storage);
+    kfree(legacy_bitmap);
+}
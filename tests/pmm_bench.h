@@ -0,0 +1,9 @@
+//
+// Created by Yoav on 10/18/2026.
+//
+
+#ifndef MYKERNEL_PMM_BENCH_H
+#define MYKERNEL_PMM_BENCH_H
+
+void run_pmm_bench();
+#endif //MYKERNEL_PMM_BENCH_H
@@ -0,0 +1,187 @@
+// tests/pmm_tests.c
+#include "../memory/pmm.h"
+#include "test_framework.h"
+#include "pmm_tests.h"
+
+// The tests only touch the PMM bookkeeping, the frames themselves are never mapped
+
+static inline bool is_aligned_to_order(physical_addr addr, uint8_t order) {
+    return (addr & ((PMM_BLOCK_SIZE << order) - 1)) == 0;
+}
+
+static bool are_frames_used(physical_addr addr, size_t count) {
+    for (size_t i = 0; i < count; i++)
+        if (pmm_is_frame_free(addr + i * PMM_BLOCK_SIZE))
+            return false;
+    return true;
+}
+
+TEST(test_pmm_single_frame_roundtrip) {
+    const size_t free_before = pmm_get_free_frames_count();
+    physical_addr frame = pmm_alloc_frame();
+    CHECK_NE(frame, PMM_NO_FRAME_AVAILABLE, "pmm_alloc_frame returns a frame");
+    CHECK(is_aligned_to_order(frame, 0), "frame is page aligned");
+    CHECK(!pmm_is_frame_free(frame), "allocated frame is marked used");
+    CHECK_EQ(pmm_get_free_frames_count(), free_before - 1, "free count drops by one");
+    pmm_free_frame(frame);
+    CHECK(pmm_is_frame_free(frame), "freed frame is marked free");
+    CHECK_EQ(pmm_get_free_frames_count(), free_before, "free count restored");
+}
+
+TEST(test_pmm_reserved_memory) {
+    extern char _kernel_start;
+    CHECK(!pmm_is_frame_free(0), "frame 0 is reserved");
+    CHECK(!pmm_is_frame_free(0xB8000), "VGA buffer is reserved");
+    CHECK(!pmm_is_frame_free((physical_addr) &_kernel_start), "kernel image is reserved");
+}
+
+TEST(test_pmm_sized_from_memory_map) {
+    const physical_addr metadata_last_frame = pmm_get_kernel_reserved_end() - PMM_BLOCK_SIZE;
+    CHECK(pmm_get_total_frames_count() > 0, "PMM manages some frames");
+    CHECK(pmm_get_free_frames_count() < pmm_get_total_frames_count(), "free frames are fewer than the total");
+    CHECK(!pmm_is_frame_free(metadata_last_frame), "PMM metadata after the kernel is reserved");
+}
+
+TEST(test_pmm_multi_frame_alignment) {
+    const size_t free_before = pmm_get_free_frames_count();
+    bool ok = true;
+    for (uint8_t order = 0; order <= PMM_MAX_ORDER; order++) {
+        physical_addr block = pmm_alloc_frames(order);
+        if (block == PMM_NO_FRAME_AVAILABLE || !is_aligned_to_order(block, order) ||
+            !are_frames_used(block, (size_t) 1 << order)) {
+            ok = false;
+            break;
+        }
+        pmm_free_frames(block, order);
+    }
+    CHECK(ok, "pmm_alloc_frames returns used blocks aligned to their size");
+    CHECK_EQ(pmm_get_free_frames_count(), free_before, "free count restored after every order");
+}
+
+TEST(test_pmm_blocks_dont_overlap) {
+    physical_addr blocks[8];
+    for (int i = 0; i < 8; i++)
+        blocks[i] = pmm_alloc_frames(i % 4);
+    bool ok = true;
+    for (int i = 0; i < 8; i++)
+        for (int j = 0; j < 8; j++) {
+            if (i == j)
+                continue;
+            const physical_addr end_i = blocks[i] + (PMM_BLOCK_SIZE << (i % 4));
+            if (blocks[j] >= blocks[i] && blocks[j] < end_i)
+                ok = false;
+        }
+    CHECK(ok, "blocks of mixed orders don't overlap");
+    for (int i = 0; i < 8; i++)
+        pmm_free_frames(blocks[i], i % 4);
+}
+
+TEST(test_pmm_split_free_merges_back) {
+    // DMA frames skip the frame cache, so the single frames go straight back to the buddy allocator
+    const size_t free_before = pmm_get_zone_stats(ZONE_DMA).free_frames;
+    physical_addr block = pmm_alloc_frames_zone(ZONE_DMA, 3);
+    CHECK_NE(block, PMM_NO_FRAME_AVAILABLE, "order 3 block allocated");
+    // Free the block one frame at a time, the buddies must merge back into a single block
+    for (size_t i = 0; i < 8; i++)
+        pmm_free_frame(block + i * PMM_BLOCK_SIZE);
+    CHECK_EQ(pmm_get_zone_stats(ZONE_DMA).free_frames, free_before, "the frames are back in the buddy allocator");
+    // The block was the lowest free one of its order (or was split from one), merged it is that again
+    physical_addr again = pmm_alloc_frames_zone(ZONE_DMA, 3);
+    CHECK_EQ(again, block, "the same order 3 block comes back after the merge");
+    pmm_free_frames(again, 3);
+}
+
+TEST(test_pmm_frame_cache_is_lifo) {
+    physical_addr frame = pmm_alloc_frame();
+    CHECK_NE(frame, PMM_NO_FRAME_AVAILABLE, "frame allocated");
+    pmm_free_frame(frame);
+    const pmm_frame_cache_stats_t before = pmm_get_frame_cache_stats();
+    CHECK(pmm_is_frame_free(frame), "cached frame counts as free");
+    physical_addr again = pmm_alloc_frame();
+    const pmm_frame_cache_stats_t after = pmm_get_frame_cache_stats();
+    CHECK_EQ(again, frame, "the last freed frame is handed out first");
+    CHECK_EQ(after.hits, before.hits + 1, "allocation was a cache hit");
+    pmm_free_frame(again);
+}
+
+TEST(test_pmm_frame_cache_drains_burst) {
+    enum { BURST = PMM_FRAME_CACHE_SIZE * 2 };
+    physical_addr frames[BURST];
+    const size_t free_before = pmm_get_free_frames_count();
+    for (size_t i = 0; i < BURST; i++)
+        frames[i] = pmm_alloc_frame();
+    for (size_t i = 0; i < BURST; i++)
+        pmm_free_frame(frames[i]);
+    CHECK(pmm_get_frame_cache_stats().cached <= PMM_FRAME_CACHE_SIZE, "cache stays bounded");
+    CHECK_EQ(pmm_get_free_frames_count(), free_before, "free count restored after a burst");
+}
+
+TEST(test_pmm_frame_refcount) {
+    physical_addr frame = pmm_alloc_frame();
+    CHECK_NE(frame, PMM_NO_FRAME_AVAILABLE, "frame allocated");
+    CHECK_EQ(pmm_frame_of(frame)->refcount, 1, "allocated frame has a single reference");
+    pmm_frame_get(frame);
+    CHECK(!pmm_frame_put(frame), "put of a shared frame doesn't free it");
+    CHECK(!pmm_is_frame_free(frame), "shared frame is still used");
+    CHECK(pmm_frame_put(frame), "last put frees the frame");
+    CHECK(pmm_is_frame_free(frame), "frame is free after the last put");
+    CHECK(pmm_frame_of(0)->flags & PMM_FRAME_RESERVED, "frame 0 has a reserved descriptor");
+}
+
+TEST(test_pmm_zeroed_pool) {
+    const size_t free_before = pmm_get_free_frames_count();
+    const size_t pool_before = pmm_get_zeroed_frames_count();
+    const size_t zeroed = pmm_zero_free_frames(4);
+    CHECK_EQ(pmm_get_zeroed_frames_count(), pool_before + zeroed, "zeroed frames go to the pool");
+    CHECK_EQ(pmm_get_free_frames_count(), free_before, "pooled frames still count as free");
+    physical_addr frame = pmm_alloc_zeroed_frame();
+    CHECK_NE(frame, PMM_NO_FRAME_AVAILABLE, "zeroed frame allocated");
+    CHECK(!pmm_is_frame_free(frame), "zeroed frame is marked used");
+    CHECK_EQ(pmm_frame_of(frame)->refcount, 1, "zeroed frame has a single reference");
+    if (pool_before + zeroed > 0)
+        CHECK_EQ(pmm_get_zeroed_frames_count(), pool_before + zeroed - 1, "frame came from the pool");
+    pmm_free_frame(frame);
+    CHECK_EQ(pmm_get_free_frames_count(), free_before, "free count restored");
+}
+
+TEST(test_pmm_dma_zone) {
+    const size_t dma_free_before = pmm_get_zone_stats(ZONE_DMA).free_frames;
+    physical_addr block = pmm_alloc_frames_zone(ZONE_DMA, 2);
+    CHECK_NE(block, PMM_NO_FRAME_AVAILABLE, "DMA block allocated");
+    CHECK(block + (PMM_BLOCK_SIZE << 2) <= PMM_DMA_ZONE_END, "DMA block is below 16MB");
+    CHECK_EQ(pmm_get_zone_stats(ZONE_DMA).free_frames, dma_free_before - 4, "DMA zone free count drops");
+    pmm_free_frames(block, 2);
+    CHECK_EQ(pmm_get_zone_stats(ZONE_DMA).free_frames, dma_free_before, "DMA frames go straight back to the zone");
+}
+
+TEST(test_pmm_zone_watermarks) {
+    bool ok = true;
+    for (pmm_zone_id_t zone = ZONE_DMA; zone < PMM_ZONES_COUNT; zone++) {
+        const pmm_zone_stats_t stats = pmm_get_zone_stats(zone);
+        if (stats.watermark_min > stats.watermark_low || stats.watermark_low > stats.watermark_high ||
+            stats.free_frames > stats.frames)
+            ok = false;
+    }
+    CHECK(ok, "zone watermarks are ordered min <= low <= high");
+    CHECK(!pmm_zone_is_low(ZONE_NORMAL), "normal zone isn't low right after boot");
+}
+
+// ---------- Main ----------
+void run_pmm_tests(void) {
+    const test_suite_t suite = begin_suite("PMM");
+
+    RUN(test_pmm_single_frame_roundtrip);
+    RUN(test_pmm_reserved_memory);
+    RUN(test_pmm_sized_from_memory_map);
+    RUN(test_pmm_multi_frame_alignment);
+    RUN(test_pmm_blocks_dont_overlap);
+    RUN(test_pmm_split_free_merges_back);
+    RUN(test_pmm_frame_cache_is_lifo);
+    RUN(test_pmm_frame_cache_drains_burst);
+    RUN(test_pmm_frame_refcount);
+    RUN(test_pmm_zeroed_pool);
+    RUN(test_pmm_dma_zone);
+    RUN(test_pmm_zone_watermarks);
+
+    end_suite(&suite);
+}
@@ -0,0 +1,54 @@
+//
+// Created by Yoav on 10/18/2026.
+//
+
+#include "test_framework.h"
+#include "disk_tests.h"
+#include "pmm_tests.h"
+#include "kmalloc_tests.h"
+#include "arena_tests.h"
+#include "page_replacement_tests.h"
+
+int g_failures = 0;
+int g_tests_run = 0;
+
+static inline void qemu_exit_code(uint8_t code) {
+    __asm__ volatile ("outb %0, %1" : : "a"(code), "Nd"(0xF4));
+    for (;;) { __asm__ volatile("hlt"); }
+}
+
+static inline void qemu_exit_pass(void) { qemu_exit_code(0x10); }
+static inline void qemu_exit_fail(void) { qemu_exit_code(0x11); }
+
+test_suite_t begin_suite(const char *name) {
+    const test_suite_t suite = {name, g_failures, g_tests_run};
+    printf("\n=== %s TESTS: START ===\n", name);
+    serial_puts("\n=== "); serial_puts(name); serial_puts(" TESTS: START ===\n");
+    return suite;
+}
+
+void end_suite(const test_suite_t *suite) {
+    const int failed = g_failures - suite->failures_before;
+    printf("\n=== %s TESTS: %s (%d failed of %d) ===\n", suite->name,
+           failed ? "FAILED" : "PASSED", failed, g_tests_run - suite->tests_before);
+    serial_puts("\n=== "); serial_puts(suite->name); serial_puts(" TESTS: ");
+    serial_puts(failed ? "FAILED" : "PASSED");
+    serial_puts(" ===\n");
+}
+
+void run_all_tests(void) {
+    run_pmm_tests();
+    run_kmalloc_tests();
+    run_arena_tests();
+    run_page_replacement_tests();
+    run_disk_tests();
+
+    printf("\n=== ALL TESTS: %s (%d failed of %d) ===\n",
+           g_failures ? "FAILED" : "PASSED", g_failures, g_tests_run);
+    serial_puts("\n=== ALL TESTS: ");
+    serial_puts(g_failures ? "FAILED" : "PASSED");
+    serial_puts(" ===\n");
+
+    if (g_failures) qemu_exit_fail();
+    else            qemu_exit_pass();
+}
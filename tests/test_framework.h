@@ -0,0 +1,65 @@
+//
+// Created by Yoav on 10/18/2026.
+//
+
+/*
+ * Tiny test framework for the in-kernel tests (built with -DRUN_TESTS).
+ * Every result is printed to the screen and mirrored to COM1 so it shows up with -serial stdio.
+ */
+
+#ifndef MYKERNEL_TEST_FRAMEWORK_H
+#define MYKERNEL_TEST_FRAMEWORK_H
+
+#include "../std/stdio.h"
+#include "../std/string.h"
+#include "../drivers/serial.h"
+
+extern int g_failures;
+extern int g_tests_run;
+
+/*
+ * Runs every test suite and exits QEMU with the result.
+ * QEMU exits with (code<<1)|1. We'll use 0x10 for PASS => exit 33; 0x11 for FAIL => exit 35.
+ */
+void run_all_tests(void);
+
+// The counters a suite started with, to report only its own results
+typedef struct {
+    const char *name;
+    int failures_before;
+    int tests_before;
+} test_suite_t;
+
+// Prints the start banner of the suite, every run_*_tests is a begin_suite, its RUN lines and an end_suite
+test_suite_t begin_suite(const char *name);
+// Prints whether the tests that ran since begin_suite passed
+void end_suite(const test_suite_t *suite);
+
+#define TEST(name) static void name(void)
+#define RUN(testfn) do { \
+    const char* tn = #testfn; \
+    printf("[ RUN ] %s\n", tn); serial_puts("[ RUN ] "); serial_puts(tn); serial_puts("\n"); \
+    g_tests_run++; testfn(); \
+} while(0)
+
+#define CHECK(cond, msg) do { \
+    if (!(cond)) { \
+        printf("[FAIL] %s\n", msg); serial_puts("[FAIL] "); \
+        serial_puts(msg); serial_puts("\n"); g_failures++; \
+    } \
+    else { \
+        printf("[PASS] %s\n", msg); serial_puts("[PASS] "); \
+        serial_puts(msg); serial_puts("\n"); \
+    } \
+} while (0)
+
+#define CHECK_EQ(a,b,msg)   CHECK((a)==(b), msg)
+#define CHECK_NE(a,b,msg)   CHECK((a)!=(b), msg)
+#define CHECK_MEMEQ(a,b,n,msg) do { \
+    if (memcmp((a),(b),(n))!=0) { \
+        printf("[FAIL] %s\n", msg); serial_puts("[FAIL] "); serial_puts(msg); serial_puts("\n"); g_failures++; } \
+    else { \
+        printf("[PASS] %s\n", msg); serial_puts("[PASS] "); serial_puts(msg); serial_puts("\n"); } \
+    } while(0)
+
+#endif //MYKERNEL_TEST_FRAMEWORK_H